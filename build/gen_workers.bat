@@ -1 +1 @@
-em++ -Isrc -v -O1 -std=c++14 src/worker/file_traverse.cxx -s  EXPORTED_FUNCTIONS="['_ReadShaders', '_ReadMapFile_Begin', '_ReadMapFile_Chunk', '_ReadImage', '_MountPackage', '_UnmountPackages']" -s BUILD_AS_WORKER=1 -s TOTAL_MEMORY=33554432 -s STB_IMAGE=1 -o worker/file_traverse.js
+em++ -Isrc -v -O1 -std=c++14 src/worker/file_traverse.cxx -s  EXPORTED_FUNCTIONS="['_ReadShaders', '_ReadMapFile_Begin', '_ReadMapFile_Chunk', '_ReadMapFile_Lumps', '_ReadImage', '_MountPackage', '_UnmountPackages']" -s BUILD_AS_WORKER=1 -s TOTAL_MEMORY=33554432 -s STB_IMAGE=1 -o worker/file_traverse.js
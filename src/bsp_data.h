@@ -286,6 +286,25 @@ struct bspVisdata_t
 	int     sizeVector;
 };
 
+// Typed, read-only window into a lump which lives in
+// memory we don't own (e.g., a memory-mapped .bsp).
+// Nothing is copied: the view is only valid while the
+// backing memory is.
+template < typename T >
+struct bspLumpView_t
+{
+	const T*	data = nullptr;
+	size_t		count = 0;
+
+	const T*	begin( void ) const { return data; }
+	const T*	end( void ) const { return data + count; }
+
+	size_t		size( void ) const { return count; }
+	bool		empty( void ) const { return count == 0; }
+
+	const T&	operator[]( size_t i ) const { return data[ i ]; }
+};
+
 struct mapData_t
 {
 	bspHeader_t	header;
@@ -395,7 +414,9 @@ enum vertexDeformCmd_t
 	VERTEXDEFORM_CMD_UNDEFINED = 0xFF,
 	VERTEXDEFORM_CMD_WAVE = 0,
 	VERTEXDEFORM_CMD_NORMAL,
-	VERTEXDEFORM_CMD_BULGE
+	VERTEXDEFORM_CMD_BULGE,
+	VERTEXDEFORM_CMD_MOVE,
+	VERTEXDEFORM_CMD_AUTOSPRITE
 };
 
 enum vertexDeformFunc_t
@@ -471,7 +492,7 @@ struct normal_t
 
 struct wave_t
 {
-	float spread;
+	float spread;	// 1 / div, for deformVertexes wave
 	float base;
 	float amplitude;
 	float phase;
@@ -485,6 +506,12 @@ struct bulge_t
 	float speed;
 };
 
+struct move_t
+{
+	wave_t wave;
+	float vector[ 3 ];
+};
+
 struct effect_t
 {
 	std::string name;
@@ -504,6 +531,7 @@ struct effect_t
 		wave_t	wave;
 		bulge_t bulge;
 		normal_t normal;
+		move_t	move;
 		float	xyzw[ 4 ];
 	} data;
 
@@ -667,7 +695,7 @@ struct shaderInfo_t
 
 	float 				cloudHeight = 0.0f;
 
-	// choose wave, normal, or bulge
+	// wave, normal, bulge, move or autosprite
 	vertexDeformCmd_t	deformCmd = VERTEXDEFORM_CMD_UNDEFINED;
 
 	// arbitrary sinusoidal functions which are applied by the command
@@ -828,7 +856,5 @@ void BspData_FixupAssetPath( char* assetPath );
 // Also assumes there is no prefix slash, since quake shader paths don't contain those.
 bspAssetBase_t BspData_GetAssetBaseFromPath( const char* assetStringPath, bspAssetBase_t* group );
 
-bool EquivalentProgramTypes( const shaderStage_t* a, const shaderStage_t* b );
-
 using shaderMap_t = std::unordered_map< std::string, shaderInfo_t >;
 using shaderMapEntry_t = std::pair< std::string, shaderInfo_t >;
@@ -49,6 +49,12 @@
 #	define EM_USE_WORKER_THREAD
 #endif
 
+// Native builds can bypass the worker entirely and
+// read lumps straight out of a memory mapping; see Q3BspMap::Read
+#if defined( __linux__ ) && !defined( EMSCRIPTEN )
+#	define Q3BSP_NATIVE_MMAP
+#endif
+
 #define INLINE inline
 
 #if defined( _WIN32 )
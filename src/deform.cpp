@@ -10,6 +10,7 @@
 #include <memory>
 #include <limits>
 #include <algorithm>
+#include <array>
 
 // Computations shamelessly stolen
 // from http://gamedev.stackexchange.com/a/49370/8185
@@ -72,6 +73,9 @@ struct baryCoordSystem_t
 // [0.0, 0.01, 0.02, ..., 0.8, 0.9, 1.0, 1.0, 0.9, 0.8, ..., 0.02, 0.01, 0.0]
 // where all of the numbers are in the range [0, 1], and distributed as a segment of 256.
 // The second half is literally just the negatives of these same values.
+//
+// Every table covers exactly one cycle, so a phase in cycles maps to
+// a table index by multiplying by DEFORM_TABLE_SIZE.
 deformGlobal_t gDeformCache =
 {
 	nullptr,// skyShader
@@ -92,7 +96,7 @@ deformGlobal_t gDeformCache =
 
 		for ( int i = 0; i < DEFORM_TABLE_SIZE; ++i )
 		{
-			ret[ i ] = glm::sin( ( float ) i / DEFORM_TABLE_SIZE );
+			ret[ i ] = glm::sin( glm::two_pi< float >() * ( float ) i / DEFORM_TABLE_SIZE );
 		}
 
 		return ret;
@@ -124,54 +128,313 @@ deformGlobal_t gDeformCache =
 
 		return ret;
 	}(),
+
+	// square wave table
+	[]( void )-> std::array< float, DEFORM_TABLE_SIZE >
+	{
+		std::array< float, DEFORM_TABLE_SIZE > ret;
+
+		for ( int i = 0; i < DEFORM_TABLE_SIZE; ++i )
+		{
+			ret[ i ] = ( i < DEFORM_TABLE_SIZE / 2 ) ? 1.0f : -1.0f;
+		}
+
+		return ret;
+	}(),
+
+	// sawtooth wave table
+	[]( void )-> std::array< float, DEFORM_TABLE_SIZE >
+	{
+		std::array< float, DEFORM_TABLE_SIZE > ret;
+
+		for ( int i = 0; i < DEFORM_TABLE_SIZE; ++i )
+		{
+			ret[ i ] = ( float ) i / DEFORM_TABLE_SIZE;
+		}
+
+		return ret;
+	}(),
+
+	// inverse sawtooth wave table
+	[]( void )-> std::array< float, DEFORM_TABLE_SIZE >
+	{
+		std::array< float, DEFORM_TABLE_SIZE > ret;
+
+		for ( int i = 0; i < DEFORM_TABLE_SIZE; ++i )
+		{
+			ret[ i ] = 1.0f - ( float ) i / DEFORM_TABLE_SIZE;
+		}
+
+		return ret;
+	}(),
+};
+
+const float* deformGlobal_t::WaveTable( vertexDeformFunc_t fn ) const
+{
+	switch ( fn )
+	{
+		case VERTEXDEFORM_FUNC_SIN: return &sinTable[ 0 ];
+		case VERTEXDEFORM_FUNC_TRIANGLE: return &triTable[ 0 ];
+		case VERTEXDEFORM_FUNC_SQUARE: return &squareTable[ 0 ];
+		case VERTEXDEFORM_FUNC_SAWTOOTH: return &sawToothTable[ 0 ];
+		case VERTEXDEFORM_FUNC_INV_SAWTOOTH: return &invSawToothTable[ 0 ];
+		default: return nullptr;
+	}
+}
+
+bool DeformUsesGPU( const shaderInfo_t* shader )
+{
+	return shader && shader->deform && shader->deformCmd == VERTEXDEFORM_CMD_WAVE;
+}
+
+//----------------------------------------------------------
+// DeformVertexSpan
+//
+// The math for each command follows Q3's tr_shade_calc.c.
+namespace {
+
+INLINE float WaveAt( const float* table, const wave_t& wave, float cycles )
+{
+	return wave.base + table[ DeformTableIndex( cycles ) ] * wave.amplitude;
+}
+
+void DeformWave( const wave_t& wave, const float* table, float time,
+	const bspVertex_t* in, bspVertex_t* out, size_t count )
+{
+	float timeCycles = wave.phase + time * wave.frequency;
+
+	for ( size_t i = 0; i < count; ++i )
+	{
+		const glm::vec3& p = in[ i ].position;
+
+		float scale = WaveAt( table, wave,
+			timeCycles + ( p.x + p.y + p.z ) * wave.spread );
+
+		out[ i ].position = p + in[ i ].normal * scale;
+	}
+}
+
+// Q3's tr_noise.c: a value and a permutation table of 256 entries,
+// seeded with srand( 1001 ). rand() is the MSVC generator Q3 shipped
+// with, so the tables come out the same on every platform.
+struct noiseTable_t
+{
+	enum
+	{
+		NOISE_SIZE = 256,
+		NOISE_MASK = NOISE_SIZE - 1
+	};
+
+	std::array< float, NOISE_SIZE > values;
+	std::array< int32_t, NOISE_SIZE > perm;
+
+	noiseTable_t( void )
+	{
+		uint32_t seed = 1001;
+
+		auto LRand = [ &seed ]( void ) -> float
+		{
+			seed = seed * 214013u + 2531011u;
+
+			// RAND_MAX is 0x7FFF
+			return ( float )( ( seed >> 16 ) & 0x7FFF ) / ( float ) 0x7FFF;
+		};
+
+		for ( int32_t i = 0; i < NOISE_SIZE; ++i )
+		{
+			values[ i ] = ( float )( LRand() * 2.0 - 1.0 );
+			perm[ i ] = ( uint8_t )( LRand() * 255 );
+		}
+	}
+
+	INLINE int32_t Perm( int32_t a ) const
+	{
+		return perm[ a & NOISE_MASK ];
+	}
+
+	INLINE float Value( int32_t x, int32_t y, int32_t z, int32_t t ) const
+	{
+		return values[ Perm( x + Perm( y + Perm( z + Perm( t ) ) ) ) ];
+	}
+
+	// R_NoiseGet4f: value noise, lerped across the 16 lattice points
+	// around ( x, y, z, t )
+	float Get4f( float x, float y, float z, float t ) const
+	{
+		int32_t ix = ( int32_t ) glm::floor( x );
+		int32_t iy = ( int32_t ) glm::floor( y );
+		int32_t iz = ( int32_t ) glm::floor( z );
+		int32_t it = ( int32_t ) glm::floor( t );
+
+		float fx = x - ( float ) ix;
+		float fy = y - ( float ) iy;
+		float fz = z - ( float ) iz;
+		float ft = t - ( float ) it;
+
+		float value[ 2 ];
+
+		for ( int32_t i = 0; i < 2; ++i )
+		{
+			float front = glm::mix(
+				glm::mix( Value( ix, iy, iz, it + i ), Value( ix + 1, iy, iz, it + i ), fx ),
+				glm::mix( Value( ix, iy + 1, iz, it + i ), Value( ix + 1, iy + 1, iz, it + i ), fx ),
+				fy );
+
+			float back = glm::mix(
+				glm::mix( Value( ix, iy, iz + 1, it + i ), Value( ix + 1, iy, iz + 1, it + i ), fx ),
+				glm::mix( Value( ix, iy + 1, iz + 1, it + i ), Value( ix + 1, iy + 1, iz + 1, it + i ), fx ),
+				fy );
+
+			value[ i ] = glm::mix( front, back, fz );
+		}
+
+		return glm::mix( value[ 0 ], value[ 1 ], ft );
+	}
 };
 
-float GenDeformScale( const glm::vec3& position, const shaderInfo_t* shader )
+const noiseTable_t& NoiseTable( void )
+{
+	static const noiseTable_t table;
+
+	return table;
+}
+
+// Each axis samples the noise at its own offset, as RB_DeformNormals does
+void DeformNormal( const wave_t& wave, float time,
+	const bspVertex_t* in, bspVertex_t* out, size_t count )
+{
+	const noiseTable_t& noise = NoiseTable();
+	float t = time * wave.frequency;
+
+	for ( size_t i = 0; i < count; ++i )
+	{
+		glm::vec3 p( in[ i ].position * 0.98f );
+		glm::vec3 n( in[ i ].normal );
+
+		n.x += wave.amplitude * noise.Get4f( p.x, p.y, p.z, t );
+		n.y += wave.amplitude * noise.Get4f( 100.0f + p.x, p.y, p.z, t );
+		n.z += wave.amplitude * noise.Get4f( 200.0f + p.x, p.y, p.z, t );
+
+		out[ i ].normal = glm::normalize( n );
+	}
+}
+
+void DeformBulge( const bulge_t& bulge, float time,
+	const bspVertex_t* in, bspVertex_t* out, size_t count )
+{
+	const float* table = &gDeformCache.sinTable[ 0 ];
+	const float toCycles = 1.0f / glm::two_pi< float >();
+	float timeCycles = time * bulge.speed * toCycles;
+
+	for ( size_t i = 0; i < count; ++i )
+	{
+		float s = in[ i ].texCoords[ 0 ].x;
+		float scale = table[ DeformTableIndex( s * bulge.width * toCycles + timeCycles ) ] * bulge.height;
+
+		out[ i ].position = in[ i ].position + in[ i ].normal * scale;
+	}
+}
+
+void DeformMove( const move_t& move, const float* table, float time,
+	const bspVertex_t* in, bspVertex_t* out, size_t count )
+{
+	glm::vec3 offset( move.vector[ 0 ], move.vector[ 1 ], move.vector[ 2 ] );
+	offset *= WaveAt( table, move.wave, move.wave.phase + time * move.wave.frequency );
+
+	for ( size_t i = 0; i < count; ++i )
+	{
+		out[ i ].position = in[ i ].position + offset;
+	}
+}
+
+// Each quad is rebuilt around its center, facing the camera, with
+// its corners assigned by where their texture coordinates sit
+// relative to the quad's middle.
+void DeformAutosprite( const deformFrame_t& frame,
+	const bspVertex_t* in, bspVertex_t* out, size_t count )
 {
-	// The solution here is also snagged from the Q3 engine.
-	if ( !shader )
-		return 0.0f;
+	size_t numQuads = count / 4;
 
-	switch ( shader->deformCmd )
+	for ( size_t q = 0; q < numQuads; ++q )
 	{
-	case VERTEXDEFORM_CMD_WAVE:
+		const bspVertex_t* v = in + q * 4;
+
+		glm::vec3 mid( ( v[ 0 ].position + v[ 1 ].position
+			+ v[ 2 ].position + v[ 3 ].position ) * 0.25f );
+
+		glm::vec2 stMid( ( v[ 0 ].texCoords[ 0 ] + v[ 1 ].texCoords[ 0 ]
+			+ v[ 2 ].texCoords[ 0 ] + v[ 3 ].texCoords[ 0 ] ) * 0.25f );
+
+		float radius = glm::length( v[ 0 ].position - mid ) * glm::one_over_root_two< float >();
+
+		glm::vec3 right( frame.viewRight * radius );
+		glm::vec3 up( frame.viewUp * radius );
+		glm::vec3 normal( glm::normalize( glm::cross( frame.viewUp, frame.viewRight ) ) );
+
+		for ( size_t j = 0; j < 4; ++j )
+		{
+			const glm::vec2& st = v[ j ].texCoords[ 0 ];
+
+			float sx = st.x < stMid.x ? -1.0f : 1.0f;
+			float sy = st.y < stMid.y ? 1.0f : -1.0f;
+
+			out[ q * 4 + j ].position = mid + right * sx + up * sy;
+			out[ q * 4 + j ].normal = normal;
+		}
+	}
+}
+
+} // namespace
+
+void DeformVertexSpan( const shaderInfo_t& shader, const deformFrame_t& frame,
+	const bspVertex_t* in, bspVertex_t* out, size_t count )
+{
+	if ( out != in )
+	{
+		std::copy( in, in + count, out );
+	}
+
+	const effect_t::data_t& parms = shader.deformParms.data;
+
+	switch ( shader.deformCmd )
+	{
+		case VERTEXDEFORM_CMD_WAVE:
 		{
-			switch ( shader->deformFn )
+			const float* table = gDeformCache.WaveTable( shader.deformFn );
+
+			if ( table )
 			{
-			case VERTEXDEFORM_FUNC_TRIANGLE:
-				{
-					// Distribute the "weight" of the tessellation spread
-					// across the length of the vertex position vector,
-					// where the vertex's tail is located at the world origin.
-					float offset =
-							shader->deformParms.data.wave.phase
-							+ ( position.x + position.y + position.z )
-							* shader->deformParms.data.wave.spread;
-
-					float t = GetTimeSeconds();
-
-					return DEFORM_CALC_TABLE(
-						gDeformCache.triTable,
-						shader->deformParms.data.wave.base,
-						offset,
-						t,
-						shader->deformParms.data.wave.frequency,
-						shader->deformParms.data.wave.amplitude
-					);
-				}
-				break;
-			default:
-				break;
+				DeformWave( parms.wave, table, frame.time, in, out, count );
 			}
 		}
-		break;
+			break;
 
-	default:
-		MLOG_WARNING( "Non-implemented vertex deform command specified." );
-		break;
-	}
+		case VERTEXDEFORM_CMD_NORMAL:
+			DeformNormal( parms.wave, frame.time, in, out, count );
+			break;
+
+		case VERTEXDEFORM_CMD_BULGE:
+			DeformBulge( parms.bulge, frame.time, in, out, count );
+			break;
+
+		case VERTEXDEFORM_CMD_MOVE:
+		{
+			const float* table = gDeformCache.WaveTable( shader.deformFn );
 
-	return 0.0f;
+			if ( table )
+			{
+				DeformMove( parms.move, table, frame.time, in, out, count );
+			}
+		}
+			break;
+
+		case VERTEXDEFORM_CMD_AUTOSPRITE:
+			DeformAutosprite( frame, in, out, count );
+			break;
+
+		default:
+			break;
+	}
 }
 
 deformGlobal_t::~deformGlobal_t( void )
@@ -297,7 +560,7 @@ void GenPatch(
 		if ( shader && shader->tessSize != 0.0f )
 			model->subdivLevel = ( int )shader->tessSize;
 		else
-			model->subdivLevel = 5;
+			model->subdivLevel = DEFORM_DEFAULT_PATCH_SUBDIV_LEVEL;
 	}
 
 	const size_t vertexStart = model->clientVertices.size();
@@ -350,18 +613,31 @@ void GenPatch(
 		}
 	}
 
-	// Compute the indices, which are designed to be used for a tri strip.
+	// Compute the indices as a triangle list, so a whole patch goes out
+	// in one draw. Each quad's two triangles wind the same way the
+	// strip they replace did: ( a, b, c ) and ( c, b, d ), with a and
+	// c on row y + 1.
 	const size_t indexStart = outIndices.size();
-	outIndices.resize( indexStart + model->subdivLevel * L1 * 2 );
+	const int subdiv = model->subdivLevel;
+	outIndices.resize( indexStart + subdiv * subdiv * 6 );
 
-	for ( int y = 0; y < model->subdivLevel; ++y )
+	for ( int y = 0; y < subdiv; ++y )
 	{
-		for ( int x = 0; x < L1; ++x )
+		for ( int x = 0; x < subdiv; ++x )
 		{
-			outIndices[ indexStart + ( y * L1 + x ) * 2 + 0 ] =
-				indexOffset + vertexStart + ( y + 1 ) * L1 + x;
-			outIndices[ indexStart + ( y * L1 + x ) * 2 + 1 ] =
-				indexOffset + vertexStart + ( y + 0 ) * L1 + x;
+			gIndex_t a = indexOffset + vertexStart + ( y + 1 ) * L1 + x;
+			gIndex_t b = indexOffset + vertexStart + ( y + 0 ) * L1 + x;
+			gIndex_t c = a + 1;
+			gIndex_t d = b + 1;
+
+			gIndex_t* quad = &outIndices[ indexStart + ( y * subdiv + x ) * 6 ];
+
+			quad[ 0 ] = a;
+			quad[ 1 ] = b;
+			quad[ 2 ] = c;
+			quad[ 3 ] = c;
+			quad[ 4 ] = b;
+			quad[ 5 ] = d;
 		}
 	}
 }
@@ -12,12 +12,18 @@
 #define DEFORM_TABLE_SIZE_LOG_2 10
 #define DEFORM_TABLE_MASK ( DEFORM_TABLE_SIZE - 1 )
 
-// TODO: think about t param and its interaction
-// with the deform cache: its passed as a float which
-// represents seconds; we may want milliseconds as an integer instead,
-// for example
+// used for patches whose shader doesn't specify a tessSize
+#define DEFORM_DEFAULT_PATCH_SUBDIV_LEVEL 5
+
+// Q3's WAVEVALUE: offset (the phase) and t * f are both in cycles.
+// t is in seconds.
 #define DEFORM_CALC_TABLE( table, base, offset, t, f, a ) \
-	( ( base ) + ( table )[ int ( ( offset ) + ( t ) * ( f ) * DEFORM_TABLE_SIZE ) & DEFORM_TABLE_MASK ] * ( a ) )
+	( ( base ) + ( table )[ DeformTableIndex( ( offset ) + ( t ) * ( f ) ) ] * ( a ) )
+
+static INLINE int32_t DeformTableIndex( float cycles )
+{
+	return ( int32_t )( ( int64_t )( cycles * DEFORM_TABLE_SIZE ) & DEFORM_TABLE_MASK );
+}
 
 struct bspFace_t;
 struct deformModel_t;
@@ -41,6 +47,11 @@ struct deformGlobal_t
 
 	std::array< float, DEFORM_TABLE_SIZE > sinTable;
 	std::array< float, DEFORM_TABLE_SIZE > triTable;
+	std::array< float, DEFORM_TABLE_SIZE > squareTable;
+	std::array< float, DEFORM_TABLE_SIZE > sawToothTable;
+	std::array< float, DEFORM_TABLE_SIZE > invSawToothTable;
+
+	const float* WaveTable( vertexDeformFunc_t fn ) const;
 
 	~deformGlobal_t( void );
 
@@ -49,7 +60,27 @@ struct deformGlobal_t
 
 extern deformGlobal_t gDeformCache;
 
-float GenDeformScale( const glm::vec3& position, const shaderInfo_t* shader );
+// Per-frame inputs shared by every deform evaluated that frame
+struct deformFrame_t
+{
+	float time = 0.0f;	// seconds
+
+	// world space camera axes, for autosprite
+	glm::vec3 viewRight = glm::vec3( 1.0f, 0.0f, 0.0f );
+	glm::vec3 viewUp = glm::vec3( 0.0f, 0.0f, 1.0f );
+};
+
+// True if the shader's deform is evaluated in its generated stage
+// programs, in which case its faces' vertex data is never touched.
+// Anything else goes through DeformVertexSpan.
+bool DeformUsesGPU( const shaderInfo_t* shader );
+
+// Writes a deformed copy of in[ 0, count ) to out, for any deformVertexes
+// command. The command is dispatched once per span, so each loop body is
+// straight line code over the whole span. autosprite treats every four
+// vertices as a quad; a trailing partial quad is copied through as is.
+void DeformVertexSpan( const shaderInfo_t& shader, const deformFrame_t& frame,
+	const bspVertex_t* in, bspVertex_t* out, size_t count );
 
 void GenPatch( gIndexBuffer_t& outIndices, mapPatch_t* model, const shaderInfo_t* shader, int controlPointStart, int indexOffset = 0 );
 
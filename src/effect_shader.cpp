@@ -32,6 +32,48 @@ const char* ReadStageTexturePath( shaderStage_t& theStage, const char* buffer )
 	return buffer;
 }
 
+// Reads "<func> <base> <amplitude> <phase> <frequency>"; fn is left
+// undefined if func isn't recognized.
+const char* ReadDeformWave( wave_t& wave, vertexDeformFunc_t& fn,
+	const char* buffer, char* token )
+{
+	ZEROTOK( token );
+	buffer = StrReadToken( token, buffer );
+
+	if ( strcmp( token, "triangle" ) == 0 )
+	{
+		fn = VERTEXDEFORM_FUNC_TRIANGLE;
+	}
+	else if ( strcmp( token, "sin" ) == 0 )
+	{
+		fn = VERTEXDEFORM_FUNC_SIN;
+	}
+	else if ( strcmp( token, "square" ) == 0 )
+	{
+		fn = VERTEXDEFORM_FUNC_SQUARE;
+	}
+	else if ( strcmp( token, "sawtooth" ) == 0 )
+	{
+		fn = VERTEXDEFORM_FUNC_SAWTOOTH;
+	}
+	else if ( strcmp( token, "inverseSawtooth" ) == 0 )
+	{
+		fn = VERTEXDEFORM_FUNC_INV_SAWTOOTH;
+	}
+	else
+	{
+		fn = VERTEXDEFORM_FUNC_UNDEFINED;
+		return buffer;
+	}
+
+	wave.base = StrReadFloat( buffer );
+	wave.amplitude = StrReadFloat( buffer );
+	wave.phase = StrReadFloat( buffer );
+	wave.frequency = StrReadFloat( buffer );
+
+	return buffer;
+}
+
 bool gIsSkyShader = false; // this saves us an O(N) lookup for every shader that's inserted.
 
 // Lookup table we use for each shader/stage command
@@ -93,76 +135,75 @@ std::unordered_map< std::string, stageEvalFunc_t > gStageReadFuncs =
 			ZEROTOK( token );
 			buffer = StrReadToken( token, buffer );
 
+			// Each command has its own signature; these follow Q3's ParseDeform
 			if ( strcmp( token, "wave" ) == 0 )
 			{
+				float div = StrReadFloat( buffer );
+
+				if ( div == 0.0f )
+				{
+					MLOG_WARNING_SANS_FUNCNAME( "deformvertexes",
+						"illegal div value of 0 in %s", &outInfo->name[ 0 ] );
+					return false;
+				}
+
+				outInfo->deformParms.data.wave.spread = 1.0f / div;
+
+				buffer = ReadDeformWave( outInfo->deformParms.data.wave,
+					outInfo->deformFn, buffer, token );
+
+				if ( outInfo->deformFn == VERTEXDEFORM_FUNC_UNDEFINED )
+				{
+					return false;
+				}
+
 				outInfo->deformCmd = VERTEXDEFORM_CMD_WAVE;
 			}
 			else if ( strcmp( token, "normal" ) == 0 )
 			{
+				outInfo->deformParms.data.wave.amplitude = StrReadFloat( buffer );
+				outInfo->deformParms.data.wave.frequency = StrReadFloat( buffer );
+
 				outInfo->deformCmd = VERTEXDEFORM_CMD_NORMAL;
 			}
 			else if ( strcmp( token, "bulge" ) == 0 )
 			{
+				outInfo->deformParms.data.bulge.width = StrReadFloat( buffer );
+				outInfo->deformParms.data.bulge.height = StrReadFloat( buffer );
+				outInfo->deformParms.data.bulge.speed = StrReadFloat( buffer );
+
 				outInfo->deformCmd = VERTEXDEFORM_CMD_BULGE;
 			}
-			else
+			else if ( strcmp( token, "move" ) == 0 )
 			{
-				return false;
-			}
+				move_t& move = outInfo->deformParms.data.move;
 
-			// Bulge and normal/wave signatures differ significantly,
-			// so we separate paths here
-			switch ( outInfo->deformCmd )
-			{
-			case VERTEXDEFORM_CMD_WAVE:
-				outInfo->deformParms.data.wave.spread = StrReadFloat( buffer );
+				move.vector[ 0 ] = StrReadFloat( buffer );
+				move.vector[ 1 ] = StrReadFloat( buffer );
+				move.vector[ 2 ] = StrReadFloat( buffer );
 
-				ZEROTOK( token );
-				buffer = StrReadToken( token, buffer );
+				buffer = ReadDeformWave( move.wave, outInfo->deformFn, buffer, token );
 
-				if ( strcmp( token, "triangle" ) == 0 )
+				if ( outInfo->deformFn == VERTEXDEFORM_FUNC_UNDEFINED )
 				{
-					outInfo->deformFn = VERTEXDEFORM_FUNC_TRIANGLE;
-				}
-				else if ( strcmp( token, "sin" ) == 0 )
-				{
-					outInfo->deformFn = VERTEXDEFORM_FUNC_SIN;
-				}
-				else if ( strcmp( token, "square" ) == 0 )
-				{
-					outInfo->deformFn = VERTEXDEFORM_FUNC_SQUARE;
-				}
-				else if ( strcmp( token, "sawtooth" ) == 0 )
-				{
-					outInfo->deformFn = VERTEXDEFORM_FUNC_SAWTOOTH;
-				}
-				else if ( strcmp( token, "inverseSawtooth" ) == 0 )
-				{
-					outInfo->deformFn = VERTEXDEFORM_FUNC_INV_SAWTOOTH;
-				}
-
-				outInfo->deformParms.data.wave.base = StrReadFloat( buffer );
-				outInfo->deformParms.data.wave.amplitude = StrReadFloat( buffer );
-
-				// Normal command has no phase translation
-				if ( outInfo->deformCmd == VERTEXDEFORM_CMD_WAVE )
-				{
-					outInfo->deformParms.data.wave.phase = StrReadFloat( buffer );
+					return false;
 				}
 
-				outInfo->deformParms.data.wave.frequency = StrReadFloat( buffer );
-
-				outInfo->deform = true;
-				break;
-
-			default:
+				outInfo->deformCmd = VERTEXDEFORM_CMD_MOVE;
+			}
+			else if ( strcmp( token, "autosprite" ) == 0 )
+			{
+				outInfo->deformCmd = VERTEXDEFORM_CMD_AUTOSPRITE;
+			}
+			else
+			{
 				MLOG_WARNING_SANS_FUNCNAME( "deformvertexes",
-					"Unsupported vertex deform found!" );
-				outInfo->deform = false;
+					"Unsupported vertex deform %s in %s", token, &outInfo->name[ 0 ] );
 				return false;
-				break;
 			}
 
+			outInfo->deform = true;
+
 			return true;
 		}
 	},
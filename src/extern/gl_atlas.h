@@ -51,6 +51,8 @@
 #include <unordered_map>
 #include <utility>
 #include <thread>
+#include <cstring>
+#include <chrono>
 
 #include "stb_image.h"
 
@@ -201,8 +203,6 @@ namespace gla {
 		size_t height,
 		uint32_t clear_val);
 
-	using image_fill_map_t = std::unordered_map<uint16_t, uint8_t>;
-
 	struct atlas_image_info_t {
 		uint8_t 	layer;
 		glm::vec2 	coords;
@@ -394,7 +394,9 @@ namespace gla {
 
 		void free_memory(void)
 		{
-			{
+			// an atlas which never made it to the GPU can be freed without
+			// a GL context, which the packing benchmark relies on
+			if (!layer_tex_handles.empty()) {
 				GLint curr_bound_tex;
 				GL_H( glGetIntegerv(GL_TEXTURE_BINDING_2D, &curr_bound_tex) );
 
@@ -445,224 +447,6 @@ namespace gla {
 		{}
 	};
 
-	//------------------
-	// gen_layer_bsp
-	//
-	// generates a layer (think of "layer" in this sense as just a texture
-	// representing a portion for a set of a group of images ).
-	// The core algorithm is based on 2D BSP generation.
-	//
-	// it assesses whether or not sorted images for this layer
-	// actually save space and how large this layer actually needs to be.
-	//
-	// the set of images a layer has will be more efficiently placed if the
-	// variation of the image sizes is high; if a layer consists
-	// of images which are of the same dimensions, then there will be a lot of unused
-	// space.
-	//
-	// idea behind BSP algol is from here:
-	// http://gamedev.stackexchange.com/a/34193
-	//------------------
-
-	class gen_layer_bsp
-	{
-		struct node_t;
-
-		using node_ptr_t = std::unique_ptr<node_t, void (*)(node_t*)>;
-		using atlas_type_t = atlas_t;
-
-		atlas_type_t& atlas;
-
-		// one for a sorted atlas, the other for an unsorted atlas. The atlas
-		// which takes the least amount of space is the winner
-		node_ptr_t root;
-		glm::ivec3 layer_dims;
-
-		// Only left child's are capable of storing image indices,
-		// from the perspective of the child's parent.
-
-		// The "lines" (expressed implicitly) will only have
-		// positive normals that face either to the right, or upward.
-		struct node_t {
-			bool region;
-			int32_t image;
-
-			glm::ivec2 origin;
-			glm::ivec2 dims;
-
-			node_t* left_child;
-			node_t* right_child;
-
-			node_t(void)
-			:   region(false),
-				image(-1),
-				origin(0, 0), dims(0, 0),
-				left_child(nullptr), right_child(nullptr)
-			{}
-
-			static void destroy(node_t* n)
-			{
-				if (n) {
-					destroy(n->left_child);
-					destroy(n->right_child);
-					delete n;
-				}
-			}
-		};
-
-		node_t* insert_node(node_t* node, uint16_t image)
-		{
-			if (node->region) {
-				node_t* n = insert_node(node->left_child, image);
-
-				if (n) {
-					node->left_child = n;
-					return node;
-				}
-
-				n = insert_node(node->right_child, image);
-
-				if (n) {
-					node->right_child = n;
-					return node;
-				}
-			} else {
-
-				if (node->image >= 0)
-					return nullptr;
-
-				glm::ivec2 image_dims(atlas.dims_x[image], atlas.dims_y[image]);
-
-				if (node->dims.x < image_dims.x || node->dims.y < image_dims.y)
-					return nullptr;
-
-				if (node->dims.x == image_dims.x
-					&& node->dims.y == image_dims.y) {
-
-					node->image = image;
-
-					if ((node->origin.x + image_dims.x) > layer_dims.x)
-						layer_dims.x = node->origin.x + image_dims.x;
-
-					if ((node->origin.y + image_dims.y) > layer_dims.y)
-						layer_dims.y = node->origin.y + image_dims.y;
-
-					assert(layer_dims.x <= root->dims.x);
-					assert(layer_dims.y <= root->dims.y);
-
-					atlas.write_origins(node->image, node->origin.x,
-						node->origin.y);
-
-					return node;
-				}
-
-				node->region = true;
-
-				uint16_t dx = node->dims.x - image_dims.x;
-				uint16_t dy = node->dims.y - image_dims.y;
-
-				node->left_child = new node_t();
-				node->right_child = new node_t();
-
-				// Is the partition line vertical?
-				if (dx > dy) {
-					node->left_child->dims.x = image_dims.x;
-					node->left_child->dims.y = node->dims.y;
-					node->left_child->origin = node->origin;
-
-					node->right_child->dims.x = dx;
-					node->right_child->dims.y = node->dims.y;
-					node->right_child->origin = node->origin;
-
-					node->right_child->origin.x += image_dims.x;
-
-				// Nope, it's horizontal
-				} else {
-					node->left_child->dims.x = node->dims.x;
-					node->left_child->dims.y = image_dims.y;
-					node->left_child->origin = node->origin;
-
-					node->right_child->dims.x = node->dims.x;
-					node->right_child->dims.y = dy;
-					node->right_child->origin = node->origin;
-
-					node->right_child->origin.y += image_dims.y;
-				}
-
-				// The only way we're able to make it here
-				// is if node's dimensions are >= the image's dimensions.
-				// If they're exactly equal, then node would have already been
-				// set and this call won't happen.
-				// Otherwise, the left child's values are set to values
-				// which have already been examined for size, or are
-				// set to one of the image's dimension values.
-
-				node->left_child = insert_node(node->left_child, image);
-
-				assert(node->left_child);
-
-				return node;
-			}
-
-			return nullptr;
-		}
-
-		bool insert(uint16_t image)
-		{
-			node_t* res = insert_node(root.get(), image);
-
-			return !!res;
-		}
-
-	public:
-
-		const glm::ivec3& dims(void) const
-		{
-			return layer_dims;
-		}
-
-		gen_layer_bsp(atlas_type_t& atlas_, image_fill_map_t& image_check)
-			:   atlas(atlas_),
-				root(new node_t(), node_t::destroy)
-		{
-			// Setup some upper bounds for the width/height values
-			{
-				GLint max_dims;
-				GL_H( glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_dims) );
-
-				uint32_t root_area_accumf =
-					next_power2((uint32_t) glm::sqrt((float) atlas.area_accum));
-
-				if ((uint32_t) max_dims > root_area_accumf)
-					max_dims = (GLint) root_area_accumf;
-
-				root->dims = glm::ivec2(max_dims, max_dims);
-			}
-
-			std::vector<uint16_t> sorted(image_check.size(), 0);
-
-			uint16_t i = 0;
-
-			for (auto image: image_check)
-				sorted[i++] = image.first;
-
-			std::sort(sorted.begin(), sorted.end(), [this](uint16_t a,
-				uint16_t b) -> bool {
-				if (atlas.dims_x[a] == atlas.dims_x[b]) {
-					return atlas.dims_y[a] > atlas.dims_y[b];
-				}
-				return atlas.dims_x[a] > atlas.dims_x[b];
-			});
-
-			for (uint16_t image: sorted) {
-				if (insert(image)) {
-					image_check[image] = 1;
-					layer_dims[2] += 1;
-				}
-			}
-		}
-	};
-
 	//------------------------------------------------------------------------------------
 	// minor texture utils
 	//------------------------------------------------------------------------------------
@@ -725,18 +509,132 @@ namespace gla {
 	#define GL_ATLAS_POST_PROCESS_RGBA_BRIGHTEN 0x1
 	#define GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA 0x2
 
+	//------------------
+	// gamma_tables_t
+	//
+	// post_process_rgba's gamma curve, tabulated. decoding only ever
+	// sees 8 bit values, so that's a straight lookup. encoding takes any
+	// float in [0, 1]: the 4096 entry table lands within a step or so of
+	// the answer, and thresholds (the smallest input which encodes to
+	// each value) settle it, so the output is exactly what
+	// encode_gamma_exact would produce.
+	//
+	// premultiplying on its own makes each channel a function of just
+	// the channel and alpha, so that case gets a table of its own and
+	// skips the encode step entirely.
+	//------------------
+
+	static ga_inline uint8_t encode_gamma_exact(float x)
+	{
+		return (uint8_t)(glm::pow(x, gammaEncode) * 255.0f);
+	}
+
+	struct gamma_tables_t {
+		static const uint32_t encode_size = 4096;
+
+		float to_linear[256];
+
+		// [256] is a sentinel nothing in [0, 1] reaches
+		float thresholds[257];
+
+		uint8_t to_gamma[encode_size];
+
+		// [alpha][channel]
+		std::vector<uint8_t> premul;
+
+		gamma_tables_t(void)
+			: premul(256 * 256)
+		{
+			for (uint32_t i = 0; i < 256; ++i) {
+				to_linear[i] = glm::pow(((float)i) * inverse255, gammaDecode);
+			}
+
+			// positive floats order the same way their bits do,
+			// so each threshold is a binary search over [0, 1]
+			uint32_t one_bits;
+			float one = 1.0f;
+			memcpy(&one_bits, &one, sizeof(one_bits));
+
+			thresholds[0] = 0.0f;
+			thresholds[256] = 2.0f;
+
+			for (uint32_t k = 1; k < 256; ++k) {
+				uint32_t lo = 0, hi = one_bits;
+
+				while (lo < hi) {
+					uint32_t mid = lo + ((hi - lo) >> 1);
+					float x;
+					memcpy(&x, &mid, sizeof(x));
+
+					if (encode_gamma_exact(x) >= k) {
+						hi = mid;
+					} else {
+						lo = mid + 1;
+					}
+				}
+
+				memcpy(&thresholds[k], &lo, sizeof(float));
+			}
+
+			for (uint32_t i = 0; i < encode_size; ++i) {
+				to_gamma[i] = encode_gamma_exact(((float)i) / (float)(encode_size - 1));
+			}
+
+			for (uint32_t a = 0; a < 256; ++a) {
+				for (uint32_t c = 0; c < 256; ++c) {
+					premul[(a << 8) | c] = encode(to_linear[c] * to_linear[a]);
+				}
+			}
+		}
+
+		uint8_t encode(float x) const
+		{
+			uint32_t k = to_gamma[(uint32_t)(x * (float)(encode_size - 1))];
+
+			while (x < thresholds[k]) {
+				k--;
+			}
+
+			while (x >= thresholds[k + 1]) {
+				k++;
+			}
+
+			return (uint8_t)k;
+		}
+	};
+
+	static ga_inline const gamma_tables_t& gamma_tables(void)
+	{
+		static const gamma_tables_t tables;
+		return tables;
+	}
+
 	static ga_inline void post_process_rgba(uint8_t* image_data, size_t length, uint32_t flags)
 	{
 		if (!flags) {
 			return;
 		}
 
+		const gamma_tables_t& tables = gamma_tables();
+
+		if (flags == GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA) {
+			for (size_t i = 0; i < length; i += 4) {
+				const uint8_t* row = &tables.premul[((size_t)image_data[i + 3]) << 8];
+
+				image_data[i + 0] = row[image_data[i + 0]];
+				image_data[i + 1] = row[image_data[i + 1]];
+				image_data[i + 2] = row[image_data[i + 2]];
+			}
+
+			return;
+		}
+
 		for (size_t i = 0; i < length; i += 4) {
 			// assume SRGB, so linearize here
-			float r = glm::pow(((float)image_data[i + 0]) * inverse255, gammaDecode);
-			float g = glm::pow(((float)image_data[i + 1]) * inverse255, gammaDecode);
-			float b = glm::pow(((float)image_data[i + 2]) * inverse255, gammaDecode);
-			float a = glm::pow(((float)image_data[i + 3]) * inverse255, gammaDecode);
+			float r = tables.to_linear[image_data[i + 0]];
+			float g = tables.to_linear[image_data[i + 1]];
+			float b = tables.to_linear[image_data[i + 2]];
+			float a = tables.to_linear[image_data[i + 3]];
 
 			if (!!(flags & GL_ATLAS_POST_PROCESS_RGBA_BRIGHTEN)) {
 				uint8_t tmp[3] = {
@@ -758,9 +656,9 @@ namespace gla {
 				b *= a;
 			}
 
-			image_data[i + 0] = (uint8_t)(glm::pow(r, gammaEncode) * 255.0f);
-			image_data[i + 1] = (uint8_t)(glm::pow(g, gammaEncode) * 255.0f);
-			image_data[i + 2] = (uint8_t)(glm::pow(b, gammaEncode) * 255.0f);
+			image_data[i + 0] = tables.encode(r);
+			image_data[i + 1] = tables.encode(g);
+			image_data[i + 2] = tables.encode(b);
 		}
 	}
 
@@ -780,82 +678,507 @@ namespace gla {
 		dest[3] = (src >> 24) & 0xFF;
 	}
 
+	// swaps whole rows through row, which only grows when an image is
+	// wider than any it's been used for before.
 	static ga_inline void flip_rows_rgba(uint8_t* image_data,
-		size_t dim_x, size_t dim_y)
+		size_t dim_x, size_t dim_y, std::vector<uint8_t>& row)
 	{
-		size_t half_dy = dim_y >> 1;
-		for (size_t y = 0; y < half_dy; ++y) {
-			for (size_t x = 0; x < dim_x; ++x) {
-				size_t top_x = (y * dim_x + x) * 4;
-				size_t bot_x = ((dim_y - y - 1) * dim_x + x) * 4;
-				uint32_t top = pack_rgba(&image_data[top_x]);
+		if (dim_y < 2) {
+			return;
+		}
 
-				unpack_rgba(&image_data[top_x],
-							pack_rgba(&image_data[bot_x]));
+		size_t stride = dim_x * 4;
 
-				unpack_rgba(&image_data[bot_x], top);
-			}
+		if (row.size() < stride) {
+			row.resize(stride);
+		}
+
+		uint8_t* top = image_data;
+		uint8_t* bottom = image_data + (dim_y - 1) * stride;
+
+		for (; top < bottom; top += stride, bottom -= stride) {
+			memcpy(&row[0], top, stride);
+			memcpy(top, bottom, stride);
+			memcpy(bottom, &row[0], stride);
 		}
 	}
 
+	static ga_inline void flip_rows_rgba(uint8_t* image_data,
+		size_t dim_x, size_t dim_y)
+	{
+		static thread_local std::vector<uint8_t> row;
+
+		flip_rows_rgba(image_data, dim_x, dim_y, row);
+	}
+
 	//------------------------------------------------------------------------------------
 	// gen
 	//------------------------------------------------------------------------------------
 
-	static ga_inline void gen_atlas_layers(atlas_t& atlas)
+	//------------------
+	// atlas_layout_t
+	//
+	// a snapshot of where gen_atlas_layers put everything. it's enough
+	// to rebuild the layers later without running the packer, provided
+	// the atlas is handed the same images in the same order.
+	//------------------
+
+	struct atlas_layout_t {
+		std::vector<uint16_t> widths;
+		std::vector<uint16_t> heights;
+
+		std::vector<uint8_t> layers;
+
+		std::vector<uint16_t> coords_x;
+		std::vector<uint16_t> coords_y;
+	};
+
+	static ga_inline atlas_layout_t get_atlas_layout(const atlas_t& atlas)
 	{
-		// Basic idea is to keep track of each image
-		// and the layer it belongs to; every image
-		// which has yet to be assigned to a layer
-		// remains in this map after a given iteration.
-		// As soon as an image is inserted, its corresponding
-		// flags is set to 1 and we remove it from this list.
-		image_fill_map_t global_unfill;
-		for (uint16_t i = 0; i < atlas.num_images; ++i) {
-			global_unfill[i] = 0;
-		}
-
-		uint8_t layer = 0;
-
-		while (!global_unfill.empty()) {
-			image_fill_map_t local_fill;
-
-			local_fill.insert(global_unfill.begin(),
-							  global_unfill.end());
-
-			// gen_layer_bsp allocates a fair amount of memory
-			// internally, so it's best to just wrap it in an
-			// inner block since we have plenty of processing to do
-			// afterward
-			uint16_t w, h;
-			{
-				gen_layer_bsp placed(atlas, local_fill);
+		atlas_layout_t layout;
+
+		layout.widths = atlas.widths;
+		layout.heights = atlas.heights;
+		layout.layers = atlas.layers;
+		layout.coords_x = atlas.coords_x;
+		layout.coords_y = atlas.coords_y;
+
+		return layout;
+	}
+
+	// image area over layer area, across every layer
+	static ga_inline float atlas_layout_efficiency(const atlas_t& atlas,
+		const atlas_layout_t& layout)
+	{
+		uint64_t layer_area = 0;
+
+		for (size_t i = 0; i < layout.widths.size(); ++i) {
+			layer_area += (uint64_t) layout.widths[i] * layout.heights[i];
+		}
+
+		uint64_t image_area = 0;
+
+		for (uint32_t i = 0; i < atlas.num_images; ++i) {
+			image_area += (uint64_t) atlas.dims_x[i] * atlas.dims_y[i];
+		}
+
+		return layer_area ? (float)((double) image_area / (double) layer_area) : 0.0f;
+	}
+
+	//------------------
+	// atlas_packer_t
+	//
+	// decides where every image goes, without touching GL; gen_atlas_layers
+	// uploads whatever layout comes back. layers can be at most max_dims
+	// on a side and should be powers of two.
+	//------------------
+
+	struct atlas_packer_t {
+		virtual ~atlas_packer_t(void) {}
+
+		virtual const char* name(void) const = 0;
+
+		// false if some image won't fit in a layer at all
+		virtual bool pack(const atlas_t& atlas, uint16_t max_dims,
+			atlas_layout_t& layout) = 0;
+	};
+
+	//------------------
+	// skyline_packer_t
+	//
+	// bottom left skyline packing, as in Jylanki's "A Thousand Ways to Pack
+	// the Bin". a layer is tracked as the outline of its top edge: a list of
+	// segments, left to right, each with the height everything below it is
+	// filled to. an image sits wherever it rests lowest, in the first layer
+	// it fits in, and a layer is only opened once nothing fits in the others.
+	// images are sorted once, tallest first, so all the layers come out of
+	// a single pass.
+	//
+	// every layer's segments live in one pool: a layer w wide can't have
+	// more than w of them, so each gets a fixed slice and nothing is
+	// allocated per placement.
+	//
+	// a few layer widths around the smallest power of two square which
+	// could hold everything are tried. the fewest layers wins, since each
+	// one is another texture to bind, then the least area. each layer is
+	// trimmed to the powers of two above what it actually used.
+	//------------------
+
+	struct skyline_packer_t : public atlas_packer_t {
+		struct segment_t {
+			uint32_t x;
+			uint32_t y;
+			uint32_t width;
+		};
+
+		struct layer_t {
+			uint32_t first; // into nodes
+			uint32_t count;
+
+			uint32_t used_x;
+			uint32_t used_y;
+		};
+
+		std::vector<segment_t> nodes;
+		std::vector<layer_t> open_layers;
+
+		uint32_t layer_width;
+		uint32_t layer_height;
 
-				const glm::ivec3& dims = placed.dims();
+		const char* name(void) const
+		{
+			return "skyline";
+		}
+
+		// the height an image w x h rests at with its left edge at the
+		// start of segment i, or UINT32_MAX if it doesn't fit there
+		uint32_t fit(const layer_t& layer, uint32_t i, uint32_t w, uint32_t h) const
+		{
+			const segment_t* s = &nodes[layer.first];
+
+			if (s[i].x + w > layer_width)
+				return UINT32_MAX;
+
+			uint32_t y = 0;
+			uint32_t remaining = w;
 
-				w = next_power2(dims[0]);
-				h = next_power2(dims[1]);
+			// the segments cover the whole width, so this always
+			// ends before running off the last one
+			for (uint32_t j = i; j < layer.count; ++j) {
+				y = std::max(y, s[j].y);
+
+				if (y + h > layer_height)
+					return UINT32_MAX;
+
+				if (s[j].width >= remaining)
+					break;
+
+				remaining -= s[j].width;
 			}
 
-			atlas.push_layer(w, h);
+			return y;
+		}
 
-			atlas.bind(layer);
+		void place(layer_t& layer, uint32_t i, uint32_t y, uint32_t w, uint32_t h)
+		{
+			segment_t* s = &nodes[layer.first];
+
+			uint32_t x = s[i].x;
+			uint32_t end = x + w;
+
+			// [i, j) are buried under the image, j may be partly
+			uint32_t j = i;
+
+			while (j < layer.count && s[j].x + s[j].width <= end)
+				j++;
+
+			if (j < layer.count && s[j].x < end) {
+				s[j].width -= end - s[j].x;
+				s[j].x = end;
+			}
+
+			// [i, j) becomes the image's top edge
+			memmove(&s[i + 1], &s[j], (layer.count - j) * sizeof(segment_t));
+			layer.count = layer.count - (j - i) + 1;
+
+			s[i].x = x;
+			s[i].y = y + h;
+			s[i].width = w;
+
+			if (i + 1 < layer.count && s[i + 1].y == s[i].y) {
+				s[i].width += s[i + 1].width;
+				memmove(&s[i + 1], &s[i + 2], (layer.count - i - 2) * sizeof(segment_t));
+				layer.count--;
+			}
+
+			if (i > 0 && s[i - 1].y == s[i].y) {
+				s[i - 1].width += s[i].width;
+				memmove(&s[i], &s[i + 1], (layer.count - i - 1) * sizeof(segment_t));
+				layer.count--;
+			}
+
+			layer.used_x = std::max(layer.used_x, end);
+			layer.used_y = std::max(layer.used_y, y + h);
+		}
+
+		void open_layer(void)
+		{
+			layer_t layer = { (uint32_t) nodes.size(), 1, 0, 0 };
+
+			nodes.resize(nodes.size() + layer_width);
+			nodes[layer.first] = { 0, 0, layer_width };
+
+			open_layers.push_back(layer);
+		}
+
+		// finds a spot in the open layers, opening a new one if needed
+		bool insert(uint32_t w, uint32_t h, uint8_t& out_layer,
+			uint16_t& out_x, uint16_t& out_y)
+		{
+			// zero sized images still need somewhere to point
+			w = std::max(w, 1u);
+			h = std::max(h, 1u);
+
+			if (w > layer_width || h > layer_height)
+				return false;
+
+			for (size_t attempt = 0; attempt < 2; ++attempt) {
+				for (size_t L = 0; L < open_layers.size(); ++L) {
+					layer_t& layer = open_layers[L];
+
+					uint32_t best_i = UINT32_MAX;
+					uint32_t best_y = UINT32_MAX;
+
+					for (uint32_t i = 0; i < layer.count; ++i) {
+						uint32_t y = fit(layer, i, w, h);
+
+						if (y < best_y) {
+							best_y = y;
+							best_i = i;
+						}
+					}
+
+					if (best_i != UINT32_MAX) {
+						out_layer = (uint8_t) L;
+						out_x = (uint16_t) nodes[layer.first + best_i].x;
+						out_y = (uint16_t) best_y;
+
+						place(layer, best_i, best_y, w, h);
+						return true;
+					}
+				}
+
+				// layer indices are 8 bits
+				if (open_layers.size() > 0xFF)
+					return false;
+
+				open_layer();
+			}
+
+			return false;
+		}
+
+		bool pack_at_width(const atlas_t& atlas, const std::vector<uint16_t>& order,
+			uint32_t width, uint32_t height, atlas_layout_t& layout)
+		{
+			layer_width = width;
+			layer_height = height;
+
+			nodes.clear();
+			open_layers.clear();
+
+			layout = atlas_layout_t();
+			layout.layers.resize(atlas.num_images, 0);
+			layout.coords_x.resize(atlas.num_images, 0);
+			layout.coords_y.resize(atlas.num_images, 0);
+
+			for (uint16_t image: order) {
+				if (!insert(atlas.dims_x[image], atlas.dims_y[image],
+						layout.layers[image], layout.coords_x[image],
+						layout.coords_y[image])) {
+					return false;
+				}
+			}
+
+			for (const layer_t& layer: open_layers) {
+				layout.widths.push_back((uint16_t) next_power2(layer.used_x));
+				layout.heights.push_back((uint16_t) next_power2(layer.used_y));
+			}
+
+			return true;
+		}
+
+		bool pack(const atlas_t& atlas, uint16_t max_dims, atlas_layout_t& layout)
+		{
+			std::vector<uint16_t> order(atlas.num_images);
+
+			uint64_t area = 0;
+			uint32_t widest = 1;
+
+			for (uint32_t i = 0; i < atlas.num_images; ++i) {
+				order[i] = (uint16_t) i;
+				area += (uint64_t) atlas.dims_x[i] * atlas.dims_y[i];
+				widest = std::max(widest, (uint32_t) atlas.dims_x[i]);
+			}
+
+			if (widest > max_dims)
+				return false;
+
+			std::sort(order.begin(), order.end(), [&atlas](uint16_t a, uint16_t b) -> bool {
+				if (atlas.dims_y[a] != atlas.dims_y[b])
+					return atlas.dims_y[a] > atlas.dims_y[b];
+
+				if (atlas.dims_x[a] != atlas.dims_x[b])
+					return atlas.dims_x[a] > atlas.dims_x[b];
+
+				return a < b;
+			});
+
+			uint32_t square = next_power2((uint32_t) glm::ceil(glm::sqrt((double) area)));
 
-			for (auto& image: local_fill) {
-				if (image.second) {
-					atlas.set_layer(image.first, layer);
-					atlas.fill_atlas_image(image.first);
-					global_unfill.erase(image.first);
+			uint64_t best_area = UINT64_MAX;
+			bool packed = false;
+
+			atlas_layout_t candidate;
+
+			for (uint32_t width: { square >> 1, square, square << 1 }) {
+				width = std::min(std::max(width, next_power2(widest)), (uint32_t) max_dims);
+
+				if (!pack_at_width(atlas, order, width, max_dims, candidate))
+					continue;
+
+				uint64_t candidate_area = 0;
+
+				for (size_t i = 0; i < candidate.widths.size(); ++i) {
+					candidate_area += (uint64_t) candidate.widths[i] * candidate.heights[i];
 				}
+
+				if (!packed
+					|| candidate.widths.size() < layout.widths.size()
+					|| (candidate.widths.size() == layout.widths.size()
+						&& candidate_area < best_area)) {
+					best_area = candidate_area;
+					layout = candidate;
+					packed = true;
+				}
+			}
+
+			return packed;
+		}
+	};
+
+	struct atlas_pack_stats_t {
+		const char* packer;
+
+		double milliseconds; // packing only: the upload isn't included
+
+		uint32_t num_layers;
+
+		float efficiency; // atlas_layout_efficiency
+	};
+
+	// creates a texture for each of layout's layers and fills it, binding
+	// each layer once. the layout is assumed to have been checked.
+	static ga_inline void upload_atlas_layout(atlas_t& atlas, const atlas_layout_t& layout)
+	{
+		size_t num_layers = layout.widths.size();
+
+		std::vector<uint32_t> offsets(num_layers + 1, 0);
+
+		for (uint32_t i = 0; i < atlas.num_images; ++i) {
+			offsets[layout.layers[i] + 1]++;
+		}
+
+		for (size_t layer = 0; layer < num_layers; ++layer) {
+			offsets[layer + 1] += offsets[layer];
+		}
+
+		std::vector<uint16_t> by_layer(atlas.num_images);
+
+		{
+			std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+
+			for (uint16_t image = 0; image < atlas.num_images; ++image) {
+				by_layer[next[layout.layers[image]]++] = image;
+			}
+		}
+
+		for (size_t layer = 0; layer < num_layers; ++layer) {
+			atlas.push_layer(layout.widths[layer], layout.heights[layer]);
+
+			atlas.bind(layer);
+
+			for (uint32_t i = offsets[layer]; i < offsets[layer + 1]; ++i) {
+				uint16_t image = by_layer[i];
+
+				atlas.set_layer(image, layer);
+				atlas.write_origins(image, layout.coords_x[image],
+					layout.coords_y[image]);
+				atlas.fill_atlas_image(image);
 			}
 
 			atlas.release();
+		}
+	}
+
+	// returns false, without touching any GL state, if the layout
+	// doesn't describe this atlas's images; the caller is expected
+	// to fall back to gen_atlas_layers in that case.
+	static ga_inline bool gen_atlas_layers_from_layout(atlas_t& atlas,
+		const atlas_layout_t& layout)
+	{
+		size_t num_layers = layout.widths.size();
+
+		if (!atlas.layer_tex_handles.empty()
+			|| num_layers == 0
+			|| layout.heights.size() != num_layers
+			|| layout.layers.size() != atlas.num_images
+			|| layout.coords_x.size() != atlas.num_images
+			|| layout.coords_y.size() != atlas.num_images) {
+			return false;
+		}
 
-			layer++;
+		GLint max_dims;
+		GL_H( glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_dims) );
+
+		for (size_t i = 0; i < num_layers; ++i) {
+			if (layout.widths[i] > max_dims || layout.heights[i] > max_dims)
+				return false;
+		}
+
+		for (uint32_t i = 0; i < atlas.num_images; ++i) {
+			uint8_t L = layout.layers[i];
+
+			if (L >= num_layers
+				|| layout.coords_x[i] + atlas.dims_x[i] > layout.widths[L]
+				|| layout.coords_y[i] + atlas.dims_y[i] > layout.heights[L]) {
+				return false;
+			}
 		}
 
-		gla_logf("Total Images: %lu\nArea Accum: %lu",
-			 atlas.num_images, atlas.area_accum);
+		upload_atlas_layout(atlas, layout);
+
+		gla_logf("Total Images: %lu\nLayers restored from layout: %lu",
+			 atlas.num_images, num_layers);
+
+		return true;
+	}
+
+	static ga_inline atlas_pack_stats_t gen_atlas_layers(atlas_t& atlas,
+		atlas_packer_t& packer)
+	{
+		atlas_pack_stats_t stats = { packer.name(), 0.0, 0, 0.0f };
+
+		GLint max_dims;
+		GL_H( glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_dims) );
+
+		// layer dimensions are 16 bits
+		max_dims = std::min(max_dims, (GLint)(1 << 15));
+
+		atlas_layout_t layout;
+
+		auto start = std::chrono::steady_clock::now();
+
+		bool packed = packer.pack(atlas, (uint16_t) max_dims, layout);
+
+		stats.milliseconds = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count();
+
+		if (!packed) {
+			gla_logf("FATAL: %s packer couldn't fit %lu images into %i x %i layers",
+				packer.name(), atlas.num_images, max_dims, max_dims);
+			atlas_error_exit();
+			return stats;
+		}
+
+		upload_atlas_layout(atlas, layout);
+
+		stats.num_layers = (uint32_t) layout.widths.size();
+		stats.efficiency = atlas_layout_efficiency(atlas, layout);
+
+		gla_logf("Total Images: %lu\nArea Accum: %lu\nPacker: %s, %.3f ms, %.1f%% used",
+			 atlas.num_images, atlas.area_accum, packer.name(),
+			 stats.milliseconds, stats.efficiency * 100.0f);
 
 		for (uint32_t i = 0; i < atlas.widths.size(); ++i) {
 			gla_logf("Layer Size [%i/%i]: %i x %i",
@@ -864,18 +1187,38 @@ namespace gla {
 				atlas.widths[i],
 				atlas.heights[i]);
 		}
+
+		return stats;
+	}
+
+	static ga_inline atlas_pack_stats_t gen_atlas_layers(atlas_t& atlas)
+	{
+		skyline_packer_t packer;
+
+		return gen_atlas_layers(atlas, packer);
+	}
+
+	// adds a dx * dy RGBA image and returns its pixels, for callers which
+	// write the final data themselves instead of going through
+	// push_atlas_image. the pointer survives later pushes, so a batch
+	// of images can be reserved first and filled in any order.
+	static ga_inline uint8_t* push_atlas_image_storage(atlas_t& atlas, int dx, int dy)
+	{
+		atlas.area_accum += dx * dy;
+
+		atlas.dims_x.push_back(dx);
+		atlas.dims_y.push_back(dy);
+
+		atlas.buffer_table.push_back(std::vector<uint8_t>(dx * dy * DESIRED_BPP));
+		atlas.num_images++;
+
+		return &atlas.buffer_table.back()[0];
 	}
 
 	static ga_inline void push_atlas_image(atlas_t& atlas,
 		uint8_t* buffer, int dx, int dy, int bpp, uint32_t post_process_flags = 0, bool flip = true)
 	{
-		std::vector<uint8_t> image_data(dx * dy * DESIRED_BPP, 0);
-
-		if (bpp == 3) {
-			convert_rgb_to_rgba(&image_data[0], buffer, dx, dy);
-		} else if (bpp == DESIRED_BPP) {
-			memcpy(&image_data[0], buffer, dx * dy * DESIRED_BPP);
-		} else {
+		if (bpp != 3 && bpp != DESIRED_BPP) {
 			gla_logf("ERROR: received image of would-be index %i" \
 			"that does not contain a supported bytes per pixel count."\
 			" Dimensions: %i x %i. BPP received: %i",
@@ -884,20 +1227,24 @@ namespace gla {
 			return;
 		}
 
-		post_process_rgba(&image_data[0], image_data.size(), post_process_flags);
+		uint8_t* image_data = push_atlas_image_storage(atlas, dx, dy);
 
-		atlas.area_accum += dx * dy;
+		if (bpp == 3) {
+			convert_rgb_to_rgba(image_data, buffer, dx, dy);
+		} else {
+			memcpy(image_data, buffer, dx * dy * DESIRED_BPP);
+		}
 
-		atlas.dims_x.push_back(dx);
-		atlas.dims_y.push_back(dy);
+		post_process_rgba(image_data, dx * dy * DESIRED_BPP, post_process_flags);
 
 		// stb_image treats the image origin as upper left and OpenGL doesn't.
+		// flip = false skips this for images whose texture coordinates
+		// already assume an upper left origin, which is true of everything
+		// the bsp renderer loads: Quake 3 st coordinates run top down, and
+		// the generated shaders sample with them as they are.
 		if ( flip ) {
-			flip_rows_rgba(&image_data[0], dx, dy);
+			flip_rows_rgba(image_data, dx, dy);
 		}
-
-		atlas.buffer_table.push_back(std::move(image_data));
-		atlas.num_images++;
 	}
 
 	static ga_inline void make_atlas_from_dir(
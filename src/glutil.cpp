@@ -5,6 +5,7 @@
 #include "renderer/texture.h"
 #include "effect_shader.h"
 #include "renderer/shader_gen.h"
+#include "renderer/gl_state.h"
 #include <algorithm>
 
 static inline void MapTexCoord( GLint location, intptr_t offset )
@@ -391,6 +392,42 @@ void GStateCheckReport( void ) {}
 // Main API
 //-------------------------------------------------------------------------------------------------
 
+static const char* gUniformSlotNames[ NUM_UNIFORM_SLOTS ] =
+{
+	"modelToView",
+	"viewToClip",
+
+	"sampler0",
+	"imageScaleRatio",
+	"imageTransform",
+
+	"mainImageSampler",
+	"mainImageImageScaleRatio",
+	"mainImageImageTransform",
+
+	"lightmapSampler",
+	"lightmapImageScaleRatio",
+	"lightmapImageTransform",
+
+	"tcModTurb",
+	"tcModScale",
+	"tcModScroll",
+	"texRotate",
+	"texCenter",
+
+	"fragDirToLight",
+	"fragAmbient",
+	"fragDirectional",
+
+	"deformWave",
+	"deformParams"
+};
+
+const char* GUniformSlotName( programUniform_t slot )
+{
+	return gUniformSlotNames[ slot ];
+}
+
 static INLINE void DisableAllAttribs( void )
 {
 	for ( int i = 0; i < 5; ++i )
@@ -399,6 +436,7 @@ static INLINE void DisableAllAttribs( void )
 
 Program::Program( const std::string& vertexShader, const std::string& fragmentShader, const std::vector< std::string >& bindAttribs )
 	: program( 0 ),
+	  dirtySlots( 0 ),
 	  stage( nullptr )
 {
 	std::string fullVertexShader( GGetGLSLHeader() + "\n" + vertexShader );
@@ -411,6 +449,8 @@ Program::Program( const std::string& vertexShader, const std::string& fragmentSh
 	};
 
 	program = LinkProgram( shaders, 2, bindAttribs );
+
+	FindSlots();
 }
 
 Program::Program( const std::string& vertexShader, const std::string& fragmentShader,
@@ -428,8 +468,20 @@ Program::Program( const std::vector< char >& vertexShader, const std::vector< ch
 	GenData( uniforms, attribs );
 }
 
+Program::Program( GLuint linkedProgram, const std::vector< std::string >& uniforms,
+	const std::vector< std::string >& attribs )
+	: program( linkedProgram ),
+	  dirtySlots( 0 ),
+	  stage( nullptr )
+{
+	FindSlots();
+	GenData( uniforms, attribs );
+}
+
 Program::Program( const Program& copy )
 	: program( copy.program ),
+	  slots( copy.slots ),
+	  dirtySlots( copy.dirtySlots ),
 	  uniforms( copy.uniforms ),
 	  attribs( copy.attribs )
 {
@@ -438,9 +490,24 @@ Program::Program( const Program& copy )
 Program::~Program( void )
 {
 	Release();
+
+	if ( gGLState.program == program )
+	{
+		GS_UseProgram( 0 );
+	}
+
 	GL_CHECK( glDeleteProgram( program ) );
 }
 
+void Program::FindSlots( void )
+{
+	for ( uint32_t i = 0; i < NUM_UNIFORM_SLOTS; ++i )
+	{
+		GL_CHECK( slots[ i ].location = glGetUniformLocation( program,
+			gUniformSlotNames[ i ] ) );
+	}
+}
+
 void Program::GenData( const std::vector< std::string >& uniforms,
 	const std::vector< std::string >& attribs )
 {
@@ -535,9 +602,59 @@ std::vector< std::string > Program::ArrayLocationNames( const std::string& name,
 #define __LOAD_VEC_ARRAY( f, name ) for ( const auto& v: ( name ) ) GL_CHECK( ( f )( v.first, v.second.size(), &v.second[ 0 ][ 0 ] ) )
 #define __LOAD_SCALAR( f, name ) for ( auto i: ( name ) ) GL_CHECK( ( f )( i.first, i.second ) )
 
+void Program::UploadSlots( void ) const
+{
+	while ( dirtySlots )
+	{
+		uint32_t i = 0;
+
+		while ( !( dirtySlots & ( 1u << i ) ) )
+		{
+			++i;
+		}
+
+		dirtySlots &= ~( 1u << i );
+
+		const uniformSlot_t& s = slots[ i ];
+
+		switch ( s.type )
+		{
+			case UNIFORM_SLOT_INT:
+			{
+				GLint v;
+				memcpy( &v, s.value, sizeof( v ) );
+				GL_CHECK( glUniform1i( s.location, v ) );
+			}
+				break;
+			case UNIFORM_SLOT_FLOAT:
+				GL_CHECK( glUniform1f( s.location, s.value[ 0 ] ) );
+				break;
+			case UNIFORM_SLOT_VEC2:
+				GL_CHECK( glUniform2fv( s.location, 1, s.value ) );
+				break;
+			case UNIFORM_SLOT_VEC3:
+				GL_CHECK( glUniform3fv( s.location, 1, s.value ) );
+				break;
+			case UNIFORM_SLOT_VEC4:
+				GL_CHECK( glUniform4fv( s.location, 1, s.value ) );
+				break;
+			case UNIFORM_SLOT_MAT2:
+				GL_CHECK( glUniformMatrix2fv( s.location, 1, GL_FALSE, s.value ) );
+				break;
+			case UNIFORM_SLOT_MAT4:
+				GL_CHECK( glUniformMatrix4fv( s.location, 1, GL_FALSE, s.value ) );
+				break;
+			default:
+				break;
+		}
+	}
+}
+
 void Program::Bind( void ) const
 {
-	GL_CHECK( glUseProgram( program ) );
+	GS_UseProgram( program );
+
+	UploadSlots();
 
 	__LOAD_VEC( glUniform2fv, vec2s );
 	__LOAD_VEC( glUniform3fv, vec3s );
@@ -560,10 +677,10 @@ void Program::Bind( void ) const
 #undef __LOAD_VEC_ARRAY
 #undef __LOAD_SCALAR
 
+// The program stays current, since the next Bind is likely to be
+// for the same one; only the values loaded by name are dropped.
 void Program::Release( void ) const
 {
-	GL_CHECK( glUseProgram( 0 ) );
-
 	vec2s.clear();
 	vec3s.clear();
 	vec4s.clear();
@@ -603,16 +720,15 @@ std::string Program::GetInfoString( void ) const
 //-------------------------------------------------------------------------------------------------
 
 loadBlend_t::loadBlend_t( GLenum srcFactor, GLenum dstFactor )
+	: prevSrcFactor( gGLState.blendSrcRGB ),
+	  prevDstFactor( gGLState.blendDstRGB )
 {
-	GL_CHECK( glGetIntegerv( GL_BLEND_SRC_RGB, ( GLint* ) &prevSrcFactor ) );
-	GL_CHECK( glGetIntegerv( GL_BLEND_DST_RGB, ( GLint* ) &prevDstFactor ) );
-
-	GL_CHECK( glBlendFunc( srcFactor, dstFactor ) );
+	GS_BlendFunc( srcFactor, dstFactor );
 }
 
 loadBlend_t::~loadBlend_t( void )
 {
-	GL_CHECK( glBlendFunc( prevSrcFactor, prevDstFactor ) );
+	GS_BlendFunc( prevSrcFactor, prevDstFactor );
 }
 
 //-------------------------------------------------------------------------------------------------
@@ -791,10 +907,9 @@ void ImmDebugDraw::End( GLenum mode, const glm::mat4& projection, const glm::mat
 {
 	Finalize( false );
 
-	GLint lastVbo;
-	GL_CHECK( glGetIntegerv( GL_ARRAY_BUFFER_BINDING, &lastVbo ) );
+	GLuint lastVbo = gGLState.arrayBuffer;
 
-	GL_CHECK( glBindBuffer( GL_ARRAY_BUFFER, vbo ) );
+	GS_BindBuffer( GL_ARRAY_BUFFER, vbo );
 
 	if ( !vertices.empty() )
 	{
@@ -821,7 +936,7 @@ void ImmDebugDraw::End( GLenum mode, const glm::mat4& projection, const glm::mat
 	GL_CHECK( glDrawArrays( mode, 0, vertices.size() ) );
 	defaultProgram->Release();
 
-	GL_CHECK( glBindBuffer( GL_ARRAY_BUFFER, ( GLuint ) lastVbo ) );
+	GS_BindBuffer( GL_ARRAY_BUFFER, lastVbo );
 
 	defaultProgram->DisableAltAttribProfiles();
 }
@@ -213,11 +213,93 @@ struct attribProfile_t
 	uintptr_t offset;
 };
 
+// Uniforms which are loaded in the per-draw path. Each program resolves
+// the location of every slot once, on creation, so loading one of these
+// is an array index rather than a string hash. Slots a program doesn't
+// declare resolve to -1, and loads into them are dropped.
+//
+// The sampler, scale ratio and transform of each texture are kept in
+// that order, since BindTexture addresses them relative to the sampler.
+enum programUniform_t
+{
+	UNIFORM_MODEL_TO_VIEW = 0,
+	UNIFORM_VIEW_TO_CLIP,
+
+	UNIFORM_SAMPLER0,
+	UNIFORM_IMAGE_SCALE_RATIO,
+	UNIFORM_IMAGE_TRANSFORM,
+
+	UNIFORM_MAIN_IMAGE_SAMPLER,
+	UNIFORM_MAIN_IMAGE_SCALE_RATIO,
+	UNIFORM_MAIN_IMAGE_TRANSFORM,
+
+	UNIFORM_LIGHTMAP_SAMPLER,
+	UNIFORM_LIGHTMAP_SCALE_RATIO,
+	UNIFORM_LIGHTMAP_TRANSFORM,
+
+	UNIFORM_TC_MOD_TURB,
+	UNIFORM_TC_MOD_SCALE,
+	UNIFORM_TC_MOD_SCROLL,
+	UNIFORM_TEX_ROTATE,
+	UNIFORM_TEX_CENTER,
+
+	UNIFORM_FRAG_DIR_TO_LIGHT,
+	UNIFORM_FRAG_AMBIENT,
+	UNIFORM_FRAG_DIRECTIONAL,
+
+	UNIFORM_DEFORM_WAVE,
+	UNIFORM_DEFORM_PARAMS,
+
+	NUM_UNIFORM_SLOTS
+};
+
+// offsets from a texture's sampler slot
+enum
+{
+	UNIFORM_TEXTURE_SCALE_RATIO_OFFSET = 1,
+	UNIFORM_TEXTURE_TRANSFORM_OFFSET = 2
+};
+
+static_assert( NUM_UNIFORM_SLOTS <= 32, "uniform slot dirty mask is 32 bits" );
+
+enum uniformSlotType_t
+{
+	UNIFORM_SLOT_NONE = 0,
+	UNIFORM_SLOT_INT,
+	UNIFORM_SLOT_FLOAT,
+	UNIFORM_SLOT_VEC2,
+	UNIFORM_SLOT_VEC3,
+	UNIFORM_SLOT_VEC4,
+	UNIFORM_SLOT_MAT2,
+	UNIFORM_SLOT_MAT4
+};
+
+// The last value loaded into a slot. A program object keeps its uniform
+// values between uses, so this only goes back to GL when it changes.
+struct uniformSlot_t
+{
+	GLint location = -1;
+	uniformSlotType_t type = UNIFORM_SLOT_NONE;
+	float value[ 16 ];
+};
+
+const char* GUniformSlotName( programUniform_t slot );
+
 class Program
 {
 private:
 	GLuint program;
 
+	mutable std::array< uniformSlot_t, NUM_UNIFORM_SLOTS > slots;
+
+	// bit i is set if slots[ i ] changed since the last Bind
+	mutable uint32_t dirtySlots;
+
+	void LoadSlot( programUniform_t slot, uniformSlotType_t type,
+		const void* value, size_t size ) const;
+
+	void UploadSlots( void ) const;
+
 #define DECL_SHADER_STORE( Type, name ) \
 		using t_##name = std::unordered_map< GLint, Type >;\
 		mutable t_##name name
@@ -243,6 +325,8 @@ private:
 	void GenData( const std::vector< std::string >& uniforms,
 		const std::vector< std::string >& attribs );
 
+	void FindSlots( void );
+
 	std::vector< attribProfile_t > altAttribProfiles;
 
 public:
@@ -275,6 +359,12 @@ public:
 		const std::vector< std::string >& uniforms,
 		const std::vector< std::string >& attribs );
 
+	// Takes ownership of an already linked program, such as one
+	// restored from the program binary cache
+	Program( GLuint linkedProgram,
+		const std::vector< std::string >& uniforms,
+		const std::vector< std::string >& attribs );
+
 	Program( const Program& copy );
 
 	~Program( void );
@@ -321,6 +411,26 @@ public:
 
 	void LoadFloat( const std::string& name, float v ) const;
 
+	// Slot counterparts of the above. A uniform should be loaded
+	// through either its slot or its name, not both: values loaded by
+	// name are always uploaded, and bypass the slot's record.
+	void LoadMat4( programUniform_t slot, const glm::mat4& t ) const;
+
+	void LoadMat2( programUniform_t slot, const glm::mat2& t ) const;
+	void LoadMat2( programUniform_t slot, const float* t ) const;
+
+	void LoadVec2( programUniform_t slot, const glm::vec2& v ) const;
+	void LoadVec2( programUniform_t slot, const float* v ) const;
+
+	void LoadVec3( programUniform_t slot, const glm::vec3& v ) const;
+
+	void LoadVec4( programUniform_t slot, const glm::vec4& v ) const;
+	void LoadVec4( programUniform_t slot, const float* v ) const;
+
+	void LoadInt( programUniform_t slot, int v ) const;
+
+	void LoadFloat( programUniform_t slot, float v ) const;
+
 	void Bind( void ) const;
 	void Release( void ) const;
 
@@ -452,6 +562,77 @@ INLINE void Program::LoadFloat( const std::string& name, float f ) const
 	floats.insert( t_floats::value_type( uniforms.at( name ), f ) );
 }
 
+INLINE void Program::LoadSlot( programUniform_t slot, uniformSlotType_t type,
+	const void* value, size_t size ) const
+{
+	uniformSlot_t& s = slots[ slot ];
+
+	if ( s.location == -1 )
+	{
+		return;
+	}
+
+	if ( s.type == type && memcmp( s.value, value, size ) == 0 )
+	{
+		return;
+	}
+
+	s.type = type;
+	memcpy( s.value, value, size );
+
+	dirtySlots |= 1u << slot;
+}
+
+INLINE void Program::LoadMat4( programUniform_t slot, const glm::mat4& t ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_MAT4, glm::value_ptr( t ), sizeof( t ) );
+}
+
+INLINE void Program::LoadMat2( programUniform_t slot, const glm::mat2& t ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_MAT2, glm::value_ptr( t ), sizeof( t ) );
+}
+
+INLINE void Program::LoadMat2( programUniform_t slot, const float* t ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_MAT2, t, sizeof( float ) * 4 );
+}
+
+INLINE void Program::LoadVec2( programUniform_t slot, const glm::vec2& v ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_VEC2, glm::value_ptr( v ), sizeof( v ) );
+}
+
+INLINE void Program::LoadVec2( programUniform_t slot, const float* v ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_VEC2, v, sizeof( float ) * 2 );
+}
+
+INLINE void Program::LoadVec3( programUniform_t slot, const glm::vec3& v ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_VEC3, glm::value_ptr( v ), sizeof( v ) );
+}
+
+INLINE void Program::LoadVec4( programUniform_t slot, const glm::vec4& v ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_VEC4, glm::value_ptr( v ), sizeof( v ) );
+}
+
+INLINE void Program::LoadVec4( programUniform_t slot, const float* v ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_VEC4, v, sizeof( float ) * 4 );
+}
+
+INLINE void Program::LoadInt( programUniform_t slot, int v ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_INT, &v, sizeof( v ) );
+}
+
+INLINE void Program::LoadFloat( programUniform_t slot, float f ) const
+{
+	LoadSlot( slot, UNIFORM_SLOT_FLOAT, &f, sizeof( f ) );
+}
+
 //-------------------------------------------------------------------------------------------------
 struct loadBlend_t
 {
@@ -7,6 +7,44 @@
 
 static gImageLoadTrackerPtr_t gImageTracker( nullptr );
 
+#if defined(WEB_WORKER_CLIENT_AIIO_READIMAGES)
+// Every worker past the first costs another copy of the worker's heap
+// and another fetch of the bundle, so only a few are used
+enum
+{
+	AIIO_MAX_IMAGE_WORKERS = 4
+};
+
+// Image decoding is spread over these. The first is gFileWebWorker; the
+// rest are more instances of the same worker, created on first use and
+// kept for later loads.
+static std::vector< const worker_t* > ImageWorkers( void )
+{
+	static std::vector< std::unique_ptr< worker_t > > extraWorkers;
+
+	if ( extraWorkers.empty() )
+	{
+		// One core is left for the main thread
+		int32_t numCores = EM_ASM_INT( { return navigator.hardwareConcurrency || 1; }, 0 );
+		int32_t numWorkers = glm::clamp( numCores - 1, 1, ( int32_t ) AIIO_MAX_IMAGE_WORKERS );
+
+		for ( int32_t i = 1; i < numWorkers; ++i )
+		{
+			extraWorkers.emplace_back( new worker_t( "worker/file_traverse.js" ) );
+		}
+	}
+
+	std::vector< const worker_t* > workers( 1, &gFileWebWorker );
+
+	for ( const auto& worker: extraWorkers )
+	{
+		workers.push_back( worker.get() );
+	}
+
+	return workers;
+}
+#endif
+
 void gImageLoadTracker_t::LogImages( void )
 {
 	std::stringstream ss;
@@ -81,14 +119,15 @@ static void AssignIndex( wApiImageInfo_t* info, uint16_t assignIndex )
 
 // What follows afterward is the image data.
 
-// The first send will always report the amount of file paths actually
-// accepted: sometimes a client-requested path or two won't actually be on
-// disk, and nothing similar will be available either; if we don't actually
-// send this then there's a good chance that that the finish function
-// won't be called.
+// The first send from each worker will always report the amount of file
+// paths it actually accepted: sometimes a client-requested path or two
+// won't actually be on disk, and nothing similar will be available either.
 
-// Once finished, we send the address of gImageTracker to
-// gImageTracker->finishEvent(). gImageTracker is a unique_ptr.
+// Several workers stream at once, so images arrive in whatever order
+// they finish decoding. Each worker ends its stream with an empty,
+// non-provisional response; once every stream has ended, we send the
+// address of gImageTracker to gImageTracker->finishEvent().
+// gImageTracker is a unique_ptr.
 static void OnImageRead( char* buffer, int size, void* param )
 {
 	UNUSED( param );
@@ -107,19 +146,14 @@ static void OnImageRead( char* buffer, int size, void* param )
 
 	wApiImageInfo_t* imageInfo = ( wApiImageInfo_t* ) buffer;
 
-	bool atEnd = gImageTracker->serverImageCount > 0
-		&& gImageTracker->iterator >= gImageTracker->serverImageCount;
-
-	if ( atEnd )
-	{
-		gImageTracker->finishEvent( &gImageTracker );
-
-		return;
-	}
-
 	if ( !imageInfo )
 	{
-		MLOG_ERROR( "%s", "nullptr should NOT be received at this stage" );
+		gImageTracker->streamsFinished++;
+
+		if ( gImageTracker->streamsFinished == gImageTracker->numStreams )
+		{
+			gImageTracker->finishEvent( &gImageTracker );
+		}
 
 		return;
 	}
@@ -136,32 +170,15 @@ static void OnImageRead( char* buffer, int size, void* param )
 		return;
 	}
 
-	if ( !gImageTracker->serverImageCount )
+	// There may not be any needed images in a worker's share of the
+	// paths. Even if that's the case, it still sends its final "ending"
+	// call, so its stream is counted as finished all the same.
+	if ( strncmp(
+			&imageInfo->name[ 0 ],
+			WAPI_IMAGE_SERVER_IMAGE_COUNT,
+			strlen( WAPI_IMAGE_SERVER_IMAGE_COUNT ) ) == 0 )
 	{
-		if ( strncmp(
-				&imageInfo->name[ 0 ],
-				WAPI_IMAGE_SERVER_IMAGE_COUNT,
-				strlen( WAPI_IMAGE_SERVER_IMAGE_COUNT ) ) == 0 )
-		{
-			gImageTracker->serverImageCount = ( size_t ) imageInfo->width;
-
-			// There may not be any needed images for this current bundle.
-			// Even if that's the case, the server will still provide its
-			// final "ending" call, so here we make sure that atEnd will
-			// resolve to true naturally on the final run.
-			if ( !gImageTracker->serverImageCount )
-			{
-				gImageTracker->serverImageCount = 0x7FFFFFFF;
-				gImageTracker->iterator = 0x7FFFFFFF;
-			}
-		}
-		else
-		{
-			MLOG_ERROR(
-				"%s",
-				"ERROR: first wApiImageInfo_t sent MUST be the header"
-			);
-		}
+		gImageTracker->serverImageCount += ( size_t ) imageInfo->width;
 
 		return;
 	}
@@ -236,25 +253,36 @@ void AIIO_ReadImages(
 		)
 	);
 
-	std::stringstream bundlePaths;
-	bundlePaths << bundlePath << ASSET_ASCII_DELIMITER;
+	// Each worker fetches the bundle on its own and decodes only the
+	// paths it's handed, so the paths are dealt out in turn
+	std::vector< const worker_t* > workers( ImageWorkers() );
+
+	size_t numStreams = glm::clamp( pathInfo.size(), ( size_t ) 1, workers.size() );
+
+	gImageTracker->numStreams = ( uint32_t ) numStreams;
 
-	for ( uint32_t i = 0; i < pathInfo.size(); ++i )
+	for ( size_t s = 0; s < numStreams; ++s )
 	{
-		bundlePaths << pathInfo[ i ].path;
+		std::stringstream bundlePaths;
+		bundlePaths << bundlePath << ASSET_ASCII_DELIMITER;
 
-		if ( ( i + 1 ) < pathInfo.size() )
+		for ( size_t i = s; i < pathInfo.size(); i += numStreams )
 		{
-			bundlePaths << ASSET_ASCII_DELIMITER;
+			if ( i != s )
+			{
+				bundlePaths << ASSET_ASCII_DELIMITER;
+			}
+
+			bundlePaths << pathInfo[ i ].path;
 		}
-	}
 
-	gFileWebWorker.Await(
-		OnImageRead,
-		"MountPackage",
-		bundlePaths.str(),
-		nullptr
-	);
+		workers[ s ]->Await(
+			OnImageRead,
+			"MountPackage",
+			bundlePaths.str(),
+			nullptr
+		);
+	}
 #else
 	UNUSED( map );
 	UNUSED( bundlePath );
@@ -48,9 +48,16 @@ struct gImageLoadTracker_t
 
 	std::unordered_map< std::string, void* > textureInfo;
 
+	// Images the workers reported in their stream headers, and how many
+	// have been assigned an index so far
 	size_t serverImageCount;
 	size_t iterator;
 
+	// One stream per worker the paths were split across; the load is done
+	// once every one of them has sent its final response
+	uint32_t numStreams;
+	uint32_t streamsFinished;
+
 	gla::atlas_t* destAtlas;
 
 	std::unordered_map< std::string, void* >
@@ -82,6 +89,8 @@ struct gImageLoadTracker_t
 			textureInfo( GenInfoMap( textureInfo_ ) ),
 			serverImageCount( 0 ),
 			iterator( 0 ),
+			numStreams( 0 ),
+			streamsFinished( 0 ),
 			destAtlas( destAtlas_ )
 	{
 	}
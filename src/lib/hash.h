@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.h"
+
+// 64 bit FNV-1a. Not cryptographic in any sense: it's only meant for
+// content keys, where the worst a collision can do is force a rebuild.
+#define HASH_FNV1A_64_SEED 0xcbf29ce484222325ull
+#define HASH_FNV1A_64_PRIME 0x100000001b3ull
+
+static INLINE uint64_t Hash_FNV1a64( const void* data, size_t size,
+	uint64_t hash = HASH_FNV1A_64_SEED )
+{
+	const uint8_t* bytes = ( const uint8_t* ) data;
+
+	for ( size_t i = 0; i < size; ++i )
+	{
+		hash ^= bytes[ i ];
+		hash *= HASH_FNV1A_64_PRIME;
+	}
+
+	return hash;
+}
+
+template < typename T >
+static INLINE uint64_t Hash_FNV1a64Value( const T& value, uint64_t hash )
+{
+	return Hash_FNV1a64( &value, sizeof( value ), hash );
+}
+
+template < typename T >
+static INLINE uint64_t Hash_FNV1a64Vector( const std::vector< T >& v, uint64_t hash )
+{
+	hash = Hash_FNV1a64Value( ( uint64_t ) v.size(), hash );
+
+	return v.empty() ? hash : Hash_FNV1a64( &v[ 0 ], sizeof( T ) * v.size(), hash );
+}
+
+// The length goes in first, so consecutive strings can't run together
+static INLINE uint64_t Hash_FNV1a64String( const std::string& s, uint64_t hash )
+{
+	hash = Hash_FNV1a64Value( ( uint64_t ) s.size(), hash );
+
+	return Hash_FNV1a64( s.data(), s.size(), hash );
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "common.h"
+
+// Native builds always have threads available; web builds
+// only do if they're compiled with pthread support (-s USE_PTHREADS=1).
+// Everything below degrades to a plain serial loop otherwise,
+// so callers don't need to care which one they get.
+#if !defined( EMSCRIPTEN ) || defined( __EMSCRIPTEN_PTHREADS__ )
+#	define PARALLEL_USE_THREADS
+#	include <thread>
+#endif
+
+#include <algorithm>
+
+enum
+{
+	PARALLEL_MAX_SPANS = 16
+};
+
+static INLINE uint32_t Parallel_NumThreads( void )
+{
+#if defined( PARALLEL_USE_THREADS )
+	uint32_t n = std::thread::hardware_concurrency();
+
+	return std::max( 1u, std::min( n, ( uint32_t ) PARALLEL_MAX_SPANS ) );
+#else
+	return 1;
+#endif
+}
+
+// The amount of spans Parallel_For will split [0, count) into,
+// given that each span is at least grain elements long. This only
+// depends on its arguments and the machine, so it can be used to
+// size a buffer of per-span partial results beforehand.
+static INLINE uint32_t Parallel_NumSpans( size_t count, size_t grain )
+{
+	if ( !count )
+	{
+		return 0;
+	}
+
+	size_t byGrain = ( count + grain - 1 ) / std::max( grain, ( size_t ) 1 );
+
+	return ( uint32_t ) std::min( byGrain, ( size_t ) Parallel_NumThreads() );
+}
+
+// Runs fn( begin, end, spanIndex ) over contiguous spans of [0, count).
+// Span boundaries are deterministic, and span 0 always runs on the
+// calling thread; this returns after every span has finished.
+// fn must not touch data shared with other spans unless it's read only.
+template < typename Tfn >
+static INLINE void Parallel_For( size_t count, size_t grain, Tfn fn )
+{
+	uint32_t numSpans = Parallel_NumSpans( count, grain );
+
+	if ( numSpans <= 1 )
+	{
+		if ( count )
+		{
+			fn( ( size_t ) 0, count, 0u );
+		}
+
+		return;
+	}
+
+	size_t spanSize = ( count + numSpans - 1 ) / numSpans;
+
+#if defined( PARALLEL_USE_THREADS )
+	std::thread threads[ PARALLEL_MAX_SPANS ];
+
+	for ( uint32_t i = 1; i < numSpans; ++i )
+	{
+		size_t begin = std::min( count, i * spanSize );
+		size_t end = std::min( count, begin + spanSize );
+
+		threads[ i ] = std::thread( fn, begin, end, i );
+	}
+
+	fn( ( size_t ) 0, std::min( count, spanSize ), 0u );
+
+	for ( uint32_t i = 1; i < numSpans; ++i )
+	{
+		threads[ i ].join();
+	}
+#else
+	for ( uint32_t i = 0; i < numSpans; ++i )
+	{
+		size_t begin = std::min( count, i * spanSize );
+		size_t end = std::min( count, begin + spanSize );
+
+		fn( begin, end, i );
+	}
+#endif
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "common.h"
+#include <array>
+
+enum
+{
+	RADIX_SORT_DIGIT_BITS = 8,
+	RADIX_SORT_NUM_BUCKETS = 1 << RADIX_SORT_DIGIT_BITS,
+	RADIX_SORT_DIGIT_MASK = RADIX_SORT_NUM_BUCKETS - 1,
+	RADIX_SORT_MAX_PASSES = 64 / RADIX_SORT_DIGIT_BITS
+};
+
+// LSD radix sort of items by the low keyBits bits of key( item ), which
+// must return something convertible to uint64_t. Items with equal keys
+// keep their relative order, whichever direction is used.
+//
+// scratch is resized to fit; keep it around between calls and nothing
+// here allocates once it's grown large enough. The two vectors may
+// have their buffers swapped on return.
+template < typename T, typename Tkey >
+static INLINE void RadixSort(
+	std::vector< T >& items,
+	std::vector< T >& scratch,
+	uint32_t keyBits,
+	bool descending,
+	Tkey key
+)
+{
+	size_t n = items.size();
+
+	if ( n < 2 )
+	{
+		return;
+	}
+
+	scratch.resize( n );
+
+	uint32_t numPasses = std::min( ( uint32_t ) RADIX_SORT_MAX_PASSES,
+		( keyBits + RADIX_SORT_DIGIT_BITS - 1 ) / RADIX_SORT_DIGIT_BITS );
+
+	// Histograms for every digit, in one read over the keys
+	std::array< std::array< uint32_t, RADIX_SORT_NUM_BUCKETS >, RADIX_SORT_MAX_PASSES > counts;
+
+	for ( uint32_t p = 0; p < numPasses; ++p )
+	{
+		counts[ p ].fill( 0 );
+	}
+
+	for ( size_t i = 0; i < n; ++i )
+	{
+		uint64_t k = ( uint64_t ) key( items[ i ] );
+
+		for ( uint32_t p = 0; p < numPasses; ++p )
+		{
+			counts[ p ][ ( k >> ( p * RADIX_SORT_DIGIT_BITS ) ) & RADIX_SORT_DIGIT_MASK ]++;
+		}
+	}
+
+	T* src = &items[ 0 ];
+	T* dst = &scratch[ 0 ];
+
+	for ( uint32_t p = 0; p < numPasses; ++p )
+	{
+		uint32_t shift = p * RADIX_SORT_DIGIT_BITS;
+		const std::array< uint32_t, RADIX_SORT_NUM_BUCKETS >& count = counts[ p ];
+
+		// A digit every key shares can't reorder anything
+		if ( count[ ( ( uint64_t ) key( src[ 0 ] ) >> shift ) & RADIX_SORT_DIGIT_MASK ] == n )
+		{
+			continue;
+		}
+
+		std::array< uint32_t, RADIX_SORT_NUM_BUCKETS > offsets;
+		uint32_t sum = 0;
+
+		if ( descending )
+		{
+			for ( int32_t b = RADIX_SORT_NUM_BUCKETS - 1; b >= 0; --b )
+			{
+				offsets[ b ] = sum;
+				sum += count[ b ];
+			}
+		}
+		else
+		{
+			for ( int32_t b = 0; b < RADIX_SORT_NUM_BUCKETS; ++b )
+			{
+				offsets[ b ] = sum;
+				sum += count[ b ];
+			}
+		}
+
+		for ( size_t i = 0; i < n; ++i )
+		{
+			uint32_t digit = ( ( uint64_t ) key( src[ i ] ) >> shift ) & RADIX_SORT_DIGIT_MASK;
+			dst[ offsets[ digit ]++ ] = src[ i ];
+		}
+
+		std::swap( src, dst );
+	}
+
+	if ( src != &items[ 0 ] )
+	{
+		items.swap( scratch );
+	}
+}
@@ -0,0 +1,588 @@
+#include "map_cache.h"
+
+#if defined( MAP_CACHE_ENABLED )
+
+#include "q3bsp.h"
+#include "model.h"
+#include "deform.h"
+#include "lib/hash.h"
+#include "extern/gl_atlas.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+
+#if defined( EMSCRIPTEN )
+#	include <emscripten.h>
+#endif
+
+//--------------------------------------------------------------
+// File layout
+//
+// [mapCacheHeader_t]
+// [bspVertex_t; numVertexes]
+// [uint32_t; numIndexes]
+// [mapCacheFace_t; numFaces]
+// [bspVertex_t; numClientVertexes]
+// [char[ BSP_MAX_SHADER_TOKEN_LENGTH ]; numOpaqueShaders + numTransparentShaders]
+// numAtlases times:
+//		[uint32_t numLayers][uint32_t numImages]
+//		[uint16_t widths; numLayers][uint16_t heights; numLayers]
+//		[uint8_t layers; numImages]
+//		[uint16_t coords_x; numImages][uint16_t coords_y; numImages]
+//
+// Every section starts on a 4 byte boundary, so the arrays can be
+// read straight out of the mapping.
+//--------------------------------------------------------------
+
+#define MAP_CACHE_MAGIC "BSPC"
+
+struct mapCacheHeader_t
+{
+	char		magic[ 4 ];
+	uint32_t	version;
+	uint64_t	key;
+
+	uint32_t	numVertexes;
+	uint32_t	numIndexes;
+	uint32_t	numFaces;
+	uint32_t	numClientVertexes;
+	uint32_t	numOpaqueShaders;
+	uint32_t	numTransparentShaders;
+	uint32_t	numAtlases;
+};
+
+static INLINE size_t Align4( size_t x )
+{
+	return ( x + 3 ) & ~( ( size_t ) 3 );
+}
+
+//--------------------------------------------------------------
+// Reading
+//--------------------------------------------------------------
+
+struct mapCacheReader_t
+{
+	const uint8_t*	base;
+	size_t			size;
+	size_t			offset;
+
+	template < typename T >
+	bool Take( bspLumpView_t< T >& view, size_t count )
+	{
+		size_t bytes = sizeof( T ) * count;
+
+		if ( bytes > size - offset )
+		{
+			return false;
+		}
+
+		view.data = ( const T* )( base + offset );
+		view.count = count;
+
+		offset = std::min( size, Align4( offset + bytes ) );
+
+		return true;
+	}
+
+	template < typename T >
+	bool TakeVector( std::vector< T >& out, size_t count )
+	{
+		bspLumpView_t< T > view;
+
+		if ( !Take( view, count ) )
+		{
+			return false;
+		}
+
+		out.assign( view.begin(), view.end() );
+
+		return true;
+	}
+};
+
+mapCache_t::~mapCache_t( void )
+{
+	MapCache_Close( *this );
+}
+
+//--------------------------------------------------------------
+// Storage
+//--------------------------------------------------------------
+
+void MapCache_Init( void )
+{
+#if defined( EMSCRIPTEN )
+	static bool mounted = false;
+
+	if ( mounted )
+	{
+		return;
+	}
+
+	mounted = true;
+
+	// syncfs( true ) copies IndexedDB into the mount asynchronously
+	EM_ASM_ARGS(
+		{
+			var dir = UTF8ToString($0);
+
+			Module.mapCacheReady = false;
+
+			FS.mkdir(dir);
+			FS.mount(IDBFS, {}, dir);
+			FS.syncfs(true, function(err) {
+				if (err) {
+					console.log('Map cache: could not load ' + dir + ' from IndexedDB: ' + err);
+					return;
+				}
+
+				Module.mapCacheReady = true;
+			});
+		},
+		MAP_CACHE_DIR
+	);
+#endif
+}
+
+bool MapCache_Ready( void )
+{
+#if defined( EMSCRIPTEN )
+	return EM_ASM_INT( { return Module.mapCacheReady ? 1 : 0; }, 0 ) != 0;
+#else
+	return true;
+#endif
+}
+
+// Writes to the mount only live in memory until they're synced back
+static void Persist( void )
+{
+#if defined( EMSCRIPTEN )
+	EM_ASM(
+		{
+			FS.syncfs(false, function(err) {
+				if (err) {
+					console.log('Map cache: could not save to IndexedDB: ' + err);
+				}
+			});
+		},
+		0
+	);
+#endif
+}
+
+std::string MapCache_GetPath( const Q3BspMap& map )
+{
+	return std::string( MAP_CACHE_DIR "/" ) + map.GetFileName() + MAP_CACHE_EXT;
+}
+
+uint64_t MapCache_MakeKey( const Q3BspMap& map, const gla::atlas_t* const* atlases )
+{
+	uint64_t hash = HASH_FNV1A_64_SEED;
+
+	hash = Hash_FNV1a64Value( ( uint32_t ) MAP_CACHE_VERSION, hash );
+	hash = Hash_FNV1a64Value( ( uint32_t ) sizeof( bspVertex_t ), hash );
+	hash = Hash_FNV1a64Value( ( uint32_t ) DEFORM_DEFAULT_PATCH_SUBDIV_LEVEL, hash );
+
+	// Vertex data has already been scaled by this point,
+	// so the scale factor is covered too
+	hash = Hash_FNV1a64Vector( map.data.vertexes, hash );
+	hash = Hash_FNV1a64Vector( map.data.meshVertexes, hash );
+	hash = Hash_FNV1a64Vector( map.data.faces, hash );
+	hash = Hash_FNV1a64Vector( map.data.shaders, hash );
+
+	// effectShaders is unordered, so visit it by name
+	std::vector< const shaderInfo_t* > shaders;
+	shaders.reserve( map.effectShaders.size() );
+
+	for ( const auto& entry: map.effectShaders )
+	{
+		shaders.push_back( &entry.second );
+	}
+
+	std::sort( shaders.begin(), shaders.end(),
+		[]( const shaderInfo_t* a, const shaderInfo_t* b ) -> bool
+		{
+			return strncmp( &a->name[ 0 ], &b->name[ 0 ], BSP_MAX_SHADER_TOKEN_LENGTH ) < 0;
+		}
+	);
+
+	for ( const shaderInfo_t* shader: shaders )
+	{
+		hash = Hash_FNV1a64( &shader->name[ 0 ], shader->name.size(), hash );
+		hash = Hash_FNV1a64Value( ( int32_t ) shader->sort, hash );
+		hash = Hash_FNV1a64Value( ( uint8_t ) shader->deform, hash );
+		hash = Hash_FNV1a64Value( ( int32_t ) shader->deformCmd, hash );
+		hash = Hash_FNV1a64Value( ( int32_t ) shader->deformFn, hash );
+		hash = Hash_FNV1a64Value( shader->tessSize, hash );
+	}
+
+	for ( uint32_t i = 0; i < MAP_CACHE_NUM_ATLASES; ++i )
+	{
+		hash = Hash_FNV1a64Value( atlases[ i ]->num_images, hash );
+		hash = Hash_FNV1a64Vector( atlases[ i ]->dims_x, hash );
+		hash = Hash_FNV1a64Vector( atlases[ i ]->dims_y, hash );
+	}
+
+	return hash;
+}
+
+static bool ReadShaderNames( mapCacheReader_t& reader,
+	std::vector< std::string >& names, uint32_t count )
+{
+	bspLumpView_t< char > view;
+
+	if ( !reader.Take( view, ( size_t ) count * BSP_MAX_SHADER_TOKEN_LENGTH ) )
+	{
+		return false;
+	}
+
+	names.resize( count );
+
+	for ( uint32_t i = 0; i < count; ++i )
+	{
+		const char* name = view.data + i * BSP_MAX_SHADER_TOKEN_LENGTH;
+
+		names[ i ].assign( name, strnlen( name, BSP_MAX_SHADER_TOKEN_LENGTH ) );
+	}
+
+	return true;
+}
+
+static bool ReadAtlasLayout( mapCacheReader_t& reader, gla::atlas_layout_t& layout )
+{
+	bspLumpView_t< uint32_t > counts;
+
+	if ( !reader.Take( counts, 2 ) )
+	{
+		return false;
+	}
+
+	uint32_t numLayers = counts[ 0 ];
+	uint32_t numImages = counts[ 1 ];
+
+	return reader.TakeVector( layout.widths, numLayers )
+		&& reader.TakeVector( layout.heights, numLayers )
+		&& reader.TakeVector( layout.layers, numImages )
+		&& reader.TakeVector( layout.coords_x, numImages )
+		&& reader.TakeVector( layout.coords_y, numImages );
+}
+
+bool MapCache_Open( mapCache_t& cache, const std::string& path, uint64_t key,
+	const Q3BspMap& map )
+{
+	MapCache_Close( cache );
+
+	if ( !MapCache_Ready() )
+	{
+		MLOG_INFO( "%s", "Map cache storage isn't loaded yet; skipping it" );
+		return false;
+	}
+
+	int fd = open( path.c_str(), O_RDONLY );
+
+	if ( fd < 0 )
+	{
+		return false;
+	}
+
+	struct stat st;
+
+	if ( fstat( fd, &st ) < 0 || ( size_t ) st.st_size < sizeof( mapCacheHeader_t ) )
+	{
+		close( fd );
+		return false;
+	}
+
+	void* mem = mmap( nullptr, ( size_t ) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+	if ( mem == MAP_FAILED )
+	{
+		MLOG_ERROR( "mmap failed for \'%s\'", path.c_str() );
+		close( fd );
+		return false;
+	}
+
+	cache.fd = fd;
+	cache.size = ( size_t ) st.st_size;
+	cache.base = ( const uint8_t* ) mem;
+
+	const mapCacheHeader_t* header = ( const mapCacheHeader_t* ) cache.base;
+
+	if ( memcmp( header->magic, MAP_CACHE_MAGIC, sizeof( header->magic ) ) != 0
+		|| header->version != MAP_CACHE_VERSION
+		|| header->numAtlases != MAP_CACHE_NUM_ATLASES )
+	{
+		MLOG_INFO( "\'%s\' is from an incompatible version; ignoring it", path.c_str() );
+		MapCache_Close( cache );
+		return false;
+	}
+
+	if ( header->key != key )
+	{
+		MLOG_INFO( "\'%s\' is stale; ignoring it", path.c_str() );
+		MapCache_Close( cache );
+		return false;
+	}
+
+	mapCacheReader_t reader { cache.base, cache.size, sizeof( mapCacheHeader_t ) };
+
+	bool good = reader.Take( cache.vertexes, header->numVertexes )
+		&& reader.Take( cache.indexes, header->numIndexes )
+		&& reader.Take( cache.faces, header->numFaces )
+		&& reader.Take( cache.clientVertexes, header->numClientVertexes )
+		&& ReadShaderNames( reader, cache.opaqueShaders, header->numOpaqueShaders )
+		&& ReadShaderNames( reader, cache.transparentShaders, header->numTransparentShaders );
+
+	for ( uint32_t i = 0; i < header->numAtlases && good; ++i )
+	{
+		cache.atlasLayouts.emplace_back( new gla::atlas_layout_t() );
+		good = ReadAtlasLayout( reader, *cache.atlasLayouts.back() );
+	}
+
+	good = good && cache.faces.size() == ( size_t ) map.data.numFaces;
+
+	// Face records index into the other sections, so check them
+	// once here rather than every time they're used
+	for ( size_t i = 0; i < cache.faces.size() && good; ++i )
+	{
+		const mapCacheFace_t& face = cache.faces[ i ];
+
+		good = ( size_t ) face.iboOffset + ( size_t ) face.iboRange <= cache.indexes.size()
+			&& face.iboRange >= 0
+			&& ( size_t ) face.vboOffset + face.numClientVertices <= cache.vertexes.size()
+			&& ( size_t ) face.clientVertexOffset + face.numClientVertices <= cache.clientVertexes.size()
+			&& ( map.data.faces[ i ].type != BSP_FACE_TYPE_PATCH || face.subdivLevel > 0 );
+	}
+
+	if ( !good )
+	{
+		MLOG_ERROR( "\'%s\' is truncated or malformed; ignoring it", path.c_str() );
+		MapCache_Close( cache );
+		return false;
+	}
+
+	return true;
+}
+
+void MapCache_Close( mapCache_t& cache )
+{
+	if ( cache.base )
+	{
+		munmap( ( void* ) cache.base, cache.size );
+	}
+
+	if ( cache.fd >= 0 )
+	{
+		close( cache.fd );
+	}
+
+	cache.fd = -1;
+	cache.size = 0;
+	cache.base = nullptr;
+
+	cache.vertexes = bspLumpView_t< bspVertex_t >();
+	cache.indexes = bspLumpView_t< uint32_t >();
+	cache.faces = bspLumpView_t< mapCacheFace_t >();
+	cache.clientVertexes = bspLumpView_t< bspVertex_t >();
+
+	cache.opaqueShaders.clear();
+	cache.transparentShaders.clear();
+	cache.atlasLayouts.clear();
+}
+
+static bool MatchShaderList( const std::vector< std::string >& names,
+	const Q3BspMap& map, shaderList_t& out )
+{
+	out.clear();
+	out.reserve( names.size() );
+
+	for ( const std::string& name: names )
+	{
+		auto it = map.effectShaders.find( name );
+
+		if ( it == map.effectShaders.end() )
+		{
+			return false;
+		}
+
+		out.push_back( &it->second );
+	}
+
+	return true;
+}
+
+bool MapCache_ApplyShaderOrder( const mapCache_t& cache, Q3BspMap& map )
+{
+	if ( cache.opaqueShaders.size() != map.opaqueShaderList.size()
+		|| cache.transparentShaders.size() != map.transparentShaderList.size() )
+	{
+		return false;
+	}
+
+	shaderList_t opaque, transparent;
+
+	if ( !MatchShaderList( cache.opaqueShaders, map, opaque )
+		|| !MatchShaderList( cache.transparentShaders, map, transparent ) )
+	{
+		return false;
+	}
+
+	map.opaqueShaderList = std::move( opaque );
+	map.transparentShaderList = std::move( transparent );
+
+	// Mirrors the index assignment in Q3BspMap::OnShaderReadFinish
+	for ( const shaderList_t* list: { &map.opaqueShaderList, &map.transparentShaderList } )
+	{
+		for ( int i = 0; i < ( int ) list->size(); ++i )
+		{
+			map.effectShaders[ &( *list )[ i ]->name[ 0 ] ].sortListIndex = i;
+		}
+	}
+
+	return true;
+}
+
+//--------------------------------------------------------------
+// Writing
+//--------------------------------------------------------------
+
+struct mapCacheWriter_t
+{
+	std::vector< uint8_t > bytes;
+
+	void Append( const void* data, size_t size )
+	{
+		bytes.insert( bytes.end(), ( const uint8_t* ) data, ( const uint8_t* ) data + size );
+		bytes.resize( Align4( bytes.size() ), 0 );
+	}
+
+	template < typename T >
+	void AppendVector( const std::vector< T >& v )
+	{
+		if ( !v.empty() )
+		{
+			Append( &v[ 0 ], sizeof( T ) * v.size() );
+		}
+	}
+};
+
+static void WriteShaderNames( mapCacheWriter_t& writer, const shaderList_t& list )
+{
+	for ( const shaderInfo_t* shader: list )
+	{
+		writer.Append( &shader->name[ 0 ], BSP_MAX_SHADER_TOKEN_LENGTH );
+	}
+}
+
+bool MapCache_Write( const std::string& path,
+	uint64_t key,
+	const Q3BspMap& map,
+	const std::vector< bspVertex_t >& vertexData,
+	const gIndexBuffer_t& indexData,
+	const std::vector< std::unique_ptr< mapModel_t > >& faces,
+	const gla::atlas_t* const* atlases )
+{
+	if ( !MapCache_Ready() )
+	{
+		return false;
+	}
+
+	std::vector< mapCacheFace_t > records( faces.size() );
+	std::vector< bspVertex_t > clientVertexes;
+
+	for ( size_t i = 0; i < faces.size(); ++i )
+	{
+		const mapModel_t& model = *faces[ i ];
+		mapCacheFace_t& record = records[ i ];
+
+		record.vboOffset = model.vboOffset;
+		record.iboOffset = ( uint32_t ) model.iboOffset;
+		record.iboRange = model.iboRange;
+		record.subdivLevel = model.subdivLevel;
+		record.boundsMin = model.bounds.minPoint;
+		record.boundsMax = model.bounds.maxPoint;
+
+		record.clientVertexOffset = ( uint32_t ) clientVertexes.size();
+		record.numClientVertices = ( uint32_t ) model.clientVertices.size();
+
+		clientVertexes.insert( clientVertexes.end(),
+			model.clientVertices.begin(), model.clientVertices.end() );
+	}
+
+	mapCacheHeader_t header = {};
+	memcpy( header.magic, MAP_CACHE_MAGIC, sizeof( header.magic ) );
+	header.version = MAP_CACHE_VERSION;
+	header.key = key;
+	header.numVertexes = ( uint32_t ) vertexData.size();
+	header.numIndexes = ( uint32_t ) indexData.size();
+	header.numFaces = ( uint32_t ) records.size();
+	header.numClientVertexes = ( uint32_t ) clientVertexes.size();
+	header.numOpaqueShaders = ( uint32_t ) map.opaqueShaderList.size();
+	header.numTransparentShaders = ( uint32_t ) map.transparentShaderList.size();
+	header.numAtlases = MAP_CACHE_NUM_ATLASES;
+
+	mapCacheWriter_t writer;
+
+	writer.Append( &header, sizeof( header ) );
+	writer.AppendVector( vertexData );
+	writer.AppendVector( indexData );
+	writer.AppendVector( records );
+	writer.AppendVector( clientVertexes );
+
+	WriteShaderNames( writer, map.opaqueShaderList );
+	WriteShaderNames( writer, map.transparentShaderList );
+
+	for ( uint32_t i = 0; i < MAP_CACHE_NUM_ATLASES; ++i )
+	{
+		gla::atlas_layout_t layout( gla::get_atlas_layout( *atlases[ i ] ) );
+
+		uint32_t counts[ 2 ] =
+		{
+			( uint32_t ) layout.widths.size(),
+			( uint32_t ) layout.layers.size()
+		};
+
+		writer.Append( counts, sizeof( counts ) );
+		writer.AppendVector( layout.widths );
+		writer.AppendVector( layout.heights );
+		writer.AppendVector( layout.layers );
+		writer.AppendVector( layout.coords_x );
+		writer.AppendVector( layout.coords_y );
+	}
+
+	mkdir( MAP_CACHE_DIR, 0755 );
+
+	// Write to the side and rename, so a crash mid-write can't
+	// leave behind a truncated file with a valid key
+	std::string tmpPath( path + ".tmp" );
+
+	FILE* f = fopen( tmpPath.c_str(), "wb" );
+
+	if ( !f )
+	{
+		MLOG_ERROR( "Could not open \'%s\' for writing", tmpPath.c_str() );
+		return false;
+	}
+
+	bool written = fwrite( &writer.bytes[ 0 ], 1, writer.bytes.size(), f ) == writer.bytes.size();
+
+	written = ( fclose( f ) == 0 ) && written;
+
+	if ( !written || rename( tmpPath.c_str(), path.c_str() ) != 0 )
+	{
+		MLOG_ERROR( "Could not write \'%s\'", path.c_str() );
+		remove( tmpPath.c_str() );
+		return false;
+	}
+
+	MLOG_INFO( "Wrote \'%s\' (" F_SIZE_T " bytes)", path.c_str(), writer.bytes.size() );
+
+	Persist();
+
+	return true;
+}
+
+#endif // MAP_CACHE_ENABLED
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "common.h"
+#include "bsp_data.h"
+#include "renderer/renderer_local.h"
+#include <memory>
+
+// Everything BSPRenderer builds from the raw map on load (vertex and
+// index buffers, patch tessellation, face bounds, shader sort order and
+// atlas packing) is a pure function of the .bsp, its shaders and the
+// tessellation settings. A .bspc file stores the result, keyed by a hash
+// of those inputs, so a warm load is an mmap and a few GPU uploads.
+//
+// Web builds keep the files in an IDBFS mount, so they persist in the
+// browser's IndexedDB between page loads.
+#if !G_STREAM_INDEX_VALUES
+#	define MAP_CACHE_ENABLED
+#endif
+
+#if defined( MAP_CACHE_ENABLED )
+
+#if defined( EMSCRIPTEN )
+#	define MAP_CACHE_DIR "/bspc"
+#else
+#	define MAP_CACHE_DIR ASSET_Q3_ROOT "/bspc"
+#endif
+
+#define MAP_CACHE_EXT ".bspc"
+
+class Q3BspMap;
+struct mapModel_t;
+
+namespace gla {
+	struct atlas_t;
+	struct atlas_layout_t;
+}
+
+enum
+{
+	MAP_CACHE_VERSION = 5,
+
+	// the shaders, main and lightmap atlases
+	MAP_CACHE_NUM_ATLASES = 3
+};
+
+// One per map face, in face order. Every face with clientVertices
+// owns a range of that list. A patch's LOD layout isn't stored, since
+// mapPatch_t::SetupLods rebuilds it from the face and subdivLevel.
+struct mapCacheFace_t
+{
+	uint32_t	vboOffset;
+	uint32_t	iboOffset;
+	int32_t		iboRange;
+	int32_t		subdivLevel;
+
+	glm::vec3	boundsMin;
+	glm::vec3	boundsMax;
+
+	uint32_t	clientVertexOffset;
+	uint32_t	numClientVertices;
+};
+
+struct mapCache_t
+{
+	int									fd = -1;
+	size_t								size = 0;
+	const uint8_t*						base = nullptr;
+
+	// These all point into the mapping
+	bspLumpView_t< bspVertex_t >		vertexes;
+	bspLumpView_t< uint32_t >			indexes;
+	bspLumpView_t< mapCacheFace_t >		faces;
+	bspLumpView_t< bspVertex_t >		clientVertexes;
+
+	std::vector< std::string >			opaqueShaders;
+	std::vector< std::string >			transparentShaders;
+
+	std::vector< std::unique_ptr< gla::atlas_layout_t > > atlasLayouts;
+
+	bool								IsOpen( void ) const { return base != nullptr; }
+
+	~mapCache_t( void );
+};
+
+// Mounts MAP_CACHE_DIR and starts loading it from IndexedDB on web
+// builds; a no-op elsewhere. Safe to call more than once.
+void MapCache_Init( void );
+
+// False until the load MapCache_Init started has finished. Open and
+// Write treat the cache as missing before then.
+bool MapCache_Ready( void );
+
+std::string MapCache_GetPath( const Q3BspMap& map );
+
+// atlases must have every image pushed already; their dimensions
+// are part of the key since they determine the packing.
+uint64_t MapCache_MakeKey( const Q3BspMap& map,
+	const gla::atlas_t* const* atlases );
+
+// Returns false if the file is missing, truncated, was built from
+// a different key, or its face records don't fit map's faces;
+// cache is left closed in that case.
+bool MapCache_Open( mapCache_t& cache, const std::string& path, uint64_t key,
+	const Q3BspMap& map );
+
+void MapCache_Close( mapCache_t& cache );
+
+// Reorders map's sorted shader lists to match the cached order
+// and reassigns each shader's sortListIndex.
+bool MapCache_ApplyShaderOrder( const mapCache_t& cache, Q3BspMap& map );
+
+bool MapCache_Write( const std::string& path,
+	uint64_t key,
+	const Q3BspMap& map,
+	const std::vector< bspVertex_t >& vertexData,
+	const gIndexBuffer_t& indexData,
+	const std::vector< std::unique_ptr< mapModel_t > >& faces,
+	const gla::atlas_t* const* atlases );
+
+#endif // MAP_CACHE_ENABLED
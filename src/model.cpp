@@ -1,11 +1,11 @@
 #include "model.h"
 #include "q3bsp.h"
 
-static gIndexBuffer_t* gServiceIndexBuffer = nullptr;
+static thread_local gIndexBuffer_t* gServiceIndexBuffer = nullptr;
 
-void MapModelGenIndexBuffer( gIndexBuffer_t& buffer )
+void MapModelGenIndexBuffer( gIndexBuffer_t* buffer )
 {
-	gServiceIndexBuffer = &buffer;
+	gServiceIndexBuffer = buffer;
 }
 
 mapModel_t::mapModel_t( void )
@@ -34,10 +34,17 @@ void mapModel_t::PreGenerate( const Q3BspMap* map, size_t faceOffset )
 
 	shader = map->GetShaderInfo( faceOffset );
 
+	// Deformed faces keep a copy of the vertices their indices refer to,
+	// which is what gets deformed and written back over [ vboOffset,
+	// vboOffset + clientVertices.size() ) in the vertex buffer.
 	if ( shader && shader->deform
 		&& map->data.faces[ faceOffset ].type != BSP_FACE_TYPE_PATCH )
 	{
-		clientVertices.reserve( map->data.faces[ faceOffset ].numMeshVertexes );
+		const bspFace_t& face = map->data.faces[ faceOffset ];
+
+		vboOffset = ( GLuint ) face.vertexOffset;
+		clientVertices.assign( map->data.vertexes.begin() + face.vertexOffset,
+			map->data.vertexes.begin() + face.vertexOffset + face.numVertexes );
 	}
 }
 
@@ -63,11 +70,6 @@ void mapModel_t::Generate( std::vector< bspVertex_t >& vertexData,
 		{
 			GPushIndex( indices, index );
 		}
-
-		if ( shader && shader->deform )
-		{
-			clientVertices.push_back( map->data.vertexes[ index ] );
-		}
 	}
 }
 
@@ -115,7 +117,44 @@ void mapModel_t::CalcBounds( const mapData_t& data )
 //-----------------------------------------------------------------
 
 mapPatch_t::mapPatch_t( void )
+	: numLods( 0 ),
+	  lodGroup( -1 )
+{
+}
+
+void mapPatch_t::SetupLods( const bspFace_t& face )
 {
+	// Deforms done on the CPU touch every vertex of the patch, so
+	// those only get the level their shader asks for
+	bool singleLod = shader && shader->deform && !DeformUsesGPU( shader );
+
+	int32_t numSubPatches = ( ( face.patchDimensions[ 0 ] - 1 ) / 2 )
+		* ( ( face.patchDimensions[ 1 ] - 1 ) / 2 );
+
+	int32_t level = singleLod ? subdivLevel : subdivLevel * 2;
+	uint32_t indexOffset = 0;
+
+	numLods = 0;
+
+	while ( numLods < PATCH_MAX_LODS )
+	{
+		patchLod_t& lod = lods[ numLods++ ];
+
+		// two triangles for every quad of every sub-patch
+		lod.subdivLevel = level;
+		lod.indexOffset = indexOffset;
+		lod.numIndices = ( GLsizei )( numSubPatches * level * level * 6 );
+
+		indexOffset += ( uint32_t ) lod.numIndices;
+
+		if ( singleLod || level == 1 )
+		{
+			break;
+		}
+
+		// The last level is always a single quad
+		level = ( numLods == PATCH_MAX_LODS - 1 ) ? 1 : glm::max( 1, level / 2 );
+	}
 }
 
 void mapPatch_t::Generate(  std::vector< bspVertex_t >& vertexData,
@@ -136,14 +175,6 @@ void mapPatch_t::Generate(  std::vector< bspVertex_t >& vertexData,
 	int n, m;
 	controlPoints.resize( width * height * 9 );
 
-	// buffer holds potentially ALL indices for each model, so we need to subtract the base size after patch generation
-
-	size_t store = 0;
-	if ( store )
-		store = gServiceIndexBuffer->size();
-
-	std::vector< gIndex_t > tmp;
-
 	for ( n = 0; n < width; ++n )
 	{
 		for ( m = 0; m < height; ++m )
@@ -157,20 +188,51 @@ void mapPatch_t::Generate(  std::vector< bspVertex_t >& vertexData,
 				controlPoints[ baseDest + c * 3 + 1 ] = &map->data.vertexes[ baseSource + c * face->patchDimensions[ 0 ] + 1 ];
 				controlPoints[ baseDest + c * 3 + 2 ] = &map->data.vertexes[ baseSource + c * face->patchDimensions[ 0 ] + 2 ];
 			}
+		}
+	}
 
-			if ( gServiceIndexBuffer )
-			{
-				GenPatch( *gServiceIndexBuffer,
-					this, shader, baseDest, ( int32_t ) vertexData.size() );
-			}
-			else
+	if ( shader && shader->tessSize != 0.0f )
+		subdivLevel = ( int )shader->tessSize;
+	else
+		subdivLevel = DEFORM_DEFAULT_PATCH_SUBDIV_LEVEL;
+
+	SetupLods( *face );
+
+	// buffer holds potentially ALL indices for each model, so we need to subtract the base size after patch generation
+	size_t store = gServiceIndexBuffer ? gServiceIndexBuffer->size() : 0;
+
+	std::vector< gIndex_t > tmp;
+
+	const int32_t baseSubdivLevel = subdivLevel;
+
+	// Each LOD is a complete tessellation, appended after the last;
+	// GenPatch works from subdivLevel, so it's swapped in per LOD.
+	for ( uint32_t l = 0; l < numLods; ++l )
+	{
+		subdivLevel = lods[ l ].subdivLevel;
+
+		for ( n = 0; n < width; ++n )
+		{
+			for ( m = 0; m < height; ++m )
 			{
-				GenPatch( tmp,
-					this, shader, baseDest, ( int32_t ) vertexData.size() );
+				int baseDest = ( m * width + n ) * 9;
+
+				if ( gServiceIndexBuffer )
+				{
+					GenPatch( *gServiceIndexBuffer,
+						this, shader, baseDest, ( int32_t ) vertexData.size() );
+				}
+				else
+				{
+					GenPatch( tmp,
+						this, shader, baseDest, ( int32_t ) vertexData.size() );
+				}
 			}
 		}
 	}
 
+	subdivLevel = baseSubdivLevel;
+
 	// Snag the amount which is relevant to our portion
 	if ( gServiceIndexBuffer )
 	{
@@ -186,28 +248,8 @@ void mapPatch_t::Generate(  std::vector< bspVertex_t >& vertexData,
 		}
 	}
 
-	// Calculate our row offsets; there are width * height patches, and our subdivision
-	// level represents the amount of tessellation rows for each patch, every row consisting
-	// of 2 * (subdivlevel + 1) vertices
-
-	const uint32_t L1 = subdivLevel + 1;
-	rowIndices.resize( width * height * subdivLevel, 0 );
-
-	// This will always be 2 * L1 for every row, since they're all uniform.
-	// Best thing to is be aware of what the largest number of row indices
-	// is out of all of the mapPatch_t's generated, and then create a data store (preallocated as the size of the largest number of row indices)
-	// which can be written to with the appropriate value (trisPerRow would then
-	// just be the scalar 2 * L1
-
-	// (OR just use the scalar value in glDrawElements; you could write a separate GU_MultiDrawElements which
-	// is designed to take N index buffer offsets, each of which has a range of the same size).
-
-	trisPerRow.resize( width * height * subdivLevel, 2 * L1 );
-
-	for ( size_t y = 0; y < rowIndices.size(); ++y )
-	{
-		rowIndices[ y ] = iboOffset + y * 2 * L1;
-	}
+	MLOG_ASSERT( iboRange == ( GLsizei ) lods[ numLods - 1 ].indexOffset + lods[ numLods - 1 ].numIndices,
+		"patch index count doesn't match its LOD layout" );
 
 	vertexData.insert( vertexData.end(), clientVertices.begin(), clientVertices.end() );
 }
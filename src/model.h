@@ -4,11 +4,15 @@
 #include "renderer/util.h"
 #include "renderer/buffer.h"
 #include "aabb.h"
+#include <array>
 
-void MapModelGenIndexBuffer( gIndexBuffer_t& buffer );
+// Sets the buffer Generate appends indices to on the calling thread;
+// each thread generating faces needs its own. nullptr unsets it.
+void MapModelGenIndexBuffer( gIndexBuffer_t* buffer );
 
 class Q3BspMap;
 struct bspVertex_t;
+struct bspFace_t;
 struct mapPatch_t;
 
 struct mapModel_t
@@ -45,14 +49,39 @@ struct mapModel_t
 	const mapPatch_t*					ToPatch( void ) const;
 };
 
+#define PATCH_MAX_LODS 4
+
+// One complete tessellation of a patch, as a triangle list over
+// [ iboOffset + indexOffset, iboOffset + indexOffset + numIndices )
+// of the patch's indices.
+struct patchLod_t
+{
+	int32_t		subdivLevel = 0;
+	uint32_t	indexOffset = 0;
+	GLsizei		numIndices = 0;
+};
+
 struct mapPatch_t : public mapModel_t
 {
 	std::vector< const bspVertex_t* >	controlPoints; // control point elems are stored in multiples of 9
-	guBufferOffsetList_t				rowIndices;
-	guBufferRangeList_t					trisPerRow;
+
+	// subdivLevel is the level the shader asks for; the LODs
+	// range from twice that down to a single quad per sub-patch.
+	std::array< patchLod_t, PATCH_MAX_LODS >	lods;
+	uint32_t							numLods;
+
+	// Patches which share boundary control points are in the same
+	// group, and a group is always drawn at one LOD so the edges
+	// between its patches line up.
+	int32_t								lodGroup;
 
 	mapPatch_t( void );
 
+	// Lays out lods for a patch face tessellated from subdivLevel.
+	// Every LOD's indices follow the last, finest first, so this only
+	// depends on the face and the shader.
+	void						SetupLods( const bspFace_t& face );
+
 	void						CalcBounds( const mapData_t& data ) override;
 
 	void						Generate( std::vector< bspVertex_t >& vertexData,
@@ -9,6 +9,14 @@
 #include "renderer.h"
 #include "extern/gl_atlas.h"
 #include "em_api.h"
+#include "lib/parallel.h"
+
+#if defined( Q3BSP_NATIVE_MMAP )
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -16,24 +24,17 @@ using namespace std;
 // Internal
 //------------------------------------------------------------------------------
 
-static void ScaleCoords( glm::vec3& v, float scale )
-{
-	v.x *= scale;
-	v.y *= scale;
-	v.z *= scale;
-}
-
-static void ScaleCoords( glm::vec2& v, float scale )
+// Scale, then swizzle from left-handed Z UP to right-handed Y UP.
+// These are branch-free so that the loops which call them
+// are trivially vectorizable.
+static INLINE glm::vec3 ScaleSwizzle( const glm::vec3& v, float scale )
 {
-	v.x *= scale;
-	v.y *= scale;
+	return glm::vec3( v.x * scale, v.z * scale, -( v.y * scale ) );
 }
 
-static void ScaleCoords( glm::ivec3& v, int scale )
+static INLINE glm::ivec3 ScaleSwizzle( const glm::ivec3& v, int scale )
 {
-	v.x *= scale;
-	v.y *= scale;
-	v.z *= scale;
+	return glm::ivec3( v.x * scale, v.z * scale, -( v.y * scale ) );
 }
 
 static bool TestShaderFlags(
@@ -76,6 +77,26 @@ static bool TestShaderFlags(
 // Global Functions
 //------------------------------------------------------------------------------
 
+bool Q3Bsp_ValidateHeader( const bspHeader_t& header )
+{
+	if ( header.id[ 0 ] != 'I' || header.id[ 1 ] != 'B'
+		|| header.id[ 2 ] != 'S' || header.id[ 3 ] != 'P' )
+	{
+		MLOG_WARNING( "Header ID does NOT match \'IBSP\'. ID read is: %.4s \n",
+			header.id );
+		return false;
+	}
+
+	if ( header.version != BSP_Q3_VERSION )
+	{
+		MLOG_WARNING( "Header version does NOT match %i. Version found is %i\n",
+			BSP_Q3_VERSION, header.version );
+		return false;
+	}
+
+	return true;
+}
+
 void Q3Bsp_SwizzleCoords( glm::vec3& v )
 {
 	float tmp = v.y;
@@ -100,7 +121,9 @@ void Q3Bsp_SwizzleCoords( glm::vec2& v )
 // Read Event Handling
 //------------------------------------------------------------------------------
 
-static int gBspDesc = -1;
+// Number of lumps which have arrived from the
+// current ReadMapFile_Lumps stream
+static int gBspLumpsReceived = 0;
 
 using q3BspAllocFn_t = std::function< void( char* received, mapData_t& data,
 	int length ) >;
@@ -250,6 +273,8 @@ static std::array< q3BspAllocFn_t, BSP_NUM_ENTRIES > gBspAllocTable =
 
 static void ReadChunk( char* data, int size, void* param );
 
+static void ReadLumpStream( char* data, int size, void* param );
+
 static INLINE void SendRequest( wApiChunkInfo_t& info, void* param )
 {
 #if defined(WEB_WORKER_CLIENT_SENDREQUEST)
@@ -261,6 +286,29 @@ static INLINE void SendRequest( wApiChunkInfo_t& info, void* param )
 #endif
 }
 
+// Requests every lump in the directory at once; the worker
+// streams them back through ReadLumpStream.
+static INLINE void SendLumpsRequest( const bspHeader_t& header, void* param )
+{
+#if defined(WEB_WORKER_CLIENT_SENDREQUEST)
+	std::array< wApiChunkInfo_t, BSP_NUM_ENTRIES > lumps;
+
+	for ( uint32_t i = 0; i < BSP_NUM_ENTRIES; ++i )
+	{
+		lumps[ i ].offset = header.directories[ i ].offset;
+		lumps[ i ].size = header.directories[ i ].length;
+	}
+
+	gBspLumpsReceived = 0;
+
+	gFileWebWorker.Await( ReadLumpStream, "ReadMapFile_Lumps",
+		( char* )&lumps[ 0 ], sizeof( lumps ), param );
+#else
+	UNUSED( header );
+	UNUSED( param );
+#endif
+}
+
 static INLINE void MapReadFin_UnmountFin( char* data, int size, void* param )
 {
 	UNUSED( data );
@@ -277,139 +325,162 @@ static INLINE void MapReadFin_UnmountFin( char* data, int size, void* param )
 	S_LoadShaders( map );
 }
 
-static INLINE void TestMaxMin( glm::vec3& destMax, glm::vec3& destMin, glm::vec3& point )
-{
-	if ( destMax.x < point.x ) destMax.x = point.x;
-	if ( destMax.y < point.y ) destMax.y = point.y;
-	if ( destMax.z < point.z ) destMax.z = point.z;
-
-	if ( destMin.x > point.x ) destMin.x = point.x;
-	if ( destMin.y > point.y ) destMin.y = point.y;
-	if ( destMin.z > point.z ) destMin.z = point.z;
-
-//	MLOG_INFO(
-//		"maxPoint Found: %s\n"
-//		"minPoint Found: %s",
-//		glm::to_string( destMax ).c_str(),
-//		glm::to_string( destMin ).c_str()
-//	);
-}
-
-static INLINE void TestMaxMin( glm::vec3& destMax, glm::vec3& destMin, glm::ivec3& p )
+// Running bounds over everything MapTransformData touches;
+// each span of a lump accumulates its own, and they're
+// merged afterward.
+struct mapBounds_t
 {
-	glm::vec3 point( p.x, p.y, p.z );
-
-	TestMaxMin( destMax, destMin, point );
-}
+	glm::vec3 maxPoint;
+	glm::vec3 minPoint;
 
-static void MapReadFin( Q3BspMap* map )
-{
-#if defined (WEB_WORKER_CLIENT_MAPREADFIN)	
-	// Swizzle coordinates from left-handed Z UP axis
-	// to right-handed Y UP axis.
-	// Also perform scaling, desired
-
-	glm::vec3 maxPoint( FLT_MIN ), minPoint( FLT_MAX );
-
-	for ( size_t i = 0; i < map->data.nodes.size(); ++i )
+	mapBounds_t( void )
+		:	maxPoint( -FLT_MAX ),
+			minPoint( FLT_MAX )
 	{
-		ScaleCoords( map->data.nodes[ i ].boxMax, map->GetScaleFactor() );
-		ScaleCoords( map->data.nodes[ i ].boxMin, map->GetScaleFactor() );
+	}
 
-		Q3Bsp_SwizzleCoords( map->data.nodes[ i ].boxMax );
-		Q3Bsp_SwizzleCoords( map->data.nodes[ i ].boxMin );
+	INLINE void Enclose( const glm::vec3& p )
+	{
+		maxPoint = glm::max( maxPoint, p );
+		minPoint = glm::min( minPoint, p );
+	}
 
-		TestMaxMin( maxPoint, minPoint, map->data.nodes[ i ].boxMax );
-		TestMaxMin( maxPoint, minPoint, map->data.nodes[ i ].boxMin );
+	INLINE void Enclose( const glm::ivec3& p )
+	{
+		Enclose( glm::vec3( p ) );
 	}
 
-	for ( size_t i = 0; i < map->data.leaves.size(); ++i )
+	INLINE void Enclose( const mapBounds_t& b )
 	{
-		ScaleCoords( map->data.leaves[ i ].boxMax, map->GetScaleFactor() );
-		ScaleCoords( map->data.leaves[ i ].boxMin, map->GetScaleFactor() );
+		maxPoint = glm::max( maxPoint, b.maxPoint );
+		minPoint = glm::min( minPoint, b.minPoint );
+	}
+};
 
-		Q3Bsp_SwizzleCoords( map->data.leaves[ i ].boxMax );
-		Q3Bsp_SwizzleCoords( map->data.leaves[ i ].boxMin );
+enum
+{
+	// Minimum elements per span before splitting
+	// a lump up is worth the thread overhead
+	MAP_TRANSFORM_GRAIN = 4096
+};
 
-		TestMaxMin( maxPoint, minPoint, map->data.leaves[ i ].boxMax );
-		TestMaxMin( maxPoint, minPoint, map->data.leaves[ i ].boxMin );
-	}
+// Applies fn( element, bounds ) to every element in lump,
+// splitting the lump across threads where available.
+// Per-span bounds are reduced into outBounds in span order.
+template < typename T, typename Tfn >
+static void TransformLump( std::vector< T >& lump, mapBounds_t& outBounds, Tfn fn )
+{
+	uint32_t numSpans = Parallel_NumSpans( lump.size(), MAP_TRANSFORM_GRAIN );
 
-	for ( size_t i = 0; i < map->data.planes.size(); ++i )
-	{
-		map->data.planes[ i ].distance *= map->GetScaleFactor();
+	std::array< mapBounds_t, PARALLEL_MAX_SPANS > partials;
 
-		ScaleCoords( map->data.planes[ i ].normal,
-			( float ) map->GetScaleFactor() );
+	T* elements = lump.data();
 
-		Q3Bsp_SwizzleCoords( map->data.planes[ i ].normal );
+	Parallel_For( lump.size(), MAP_TRANSFORM_GRAIN,
+		[ elements, &partials, &fn ]( size_t begin, size_t end, uint32_t span )
+		{
+			mapBounds_t bounds;
 
-		TestMaxMin( maxPoint, minPoint, map->data.planes[ i ].normal );
-	}
+			for ( size_t i = begin; i < end; ++i )
+			{
+				fn( elements[ i ], bounds );
+			}
+
+			partials[ span ] = bounds;
+		}
+	);
 
-	for ( size_t i = 0; i < map->data.vertexes.size(); ++i )
+	for ( uint32_t i = 0; i < numSpans; ++i )
 	{
-		ScaleCoords( map->data.vertexes[ i ].texCoords[ 0 ],
-			( float ) map->GetScaleFactor() );
-		ScaleCoords( map->data.vertexes[ i ].texCoords[ 1 ],
-			( float ) map->GetScaleFactor() );
+		outBounds.Enclose( partials[ i ] );
+	}
+}
 
-		ScaleCoords( map->data.vertexes[ i ].normal,
-			( float ) map->GetScaleFactor() );
-		ScaleCoords( map->data.vertexes[ i ].position,
-			( float ) map->GetScaleFactor() );
+// Swizzle coordinates from left-handed Z UP axis
+// to right-handed Y UP axis.
+// Also perform scaling, desired
+static void MapTransformData( Q3BspMap* map )
+{
+	const int iscale = map->GetScaleFactor();
+	const float scale = ( float ) iscale;
 
-		Q3Bsp_SwizzleCoords( map->data.vertexes[ i ].position );
-		Q3Bsp_SwizzleCoords( map->data.vertexes[ i ].normal );
+	mapBounds_t bounds;
 
-		TestMaxMin( maxPoint, minPoint, map->data.vertexes[ i ].position );
-		TestMaxMin( maxPoint, minPoint, map->data.vertexes[ i ].normal );
-	}
+	// Kept from the original serial pass: the max starts at FLT_MIN,
+	// not -FLT_MAX, so skyHeightOffset never drops below it
+	bounds.maxPoint = glm::vec3( FLT_MIN );
 
-	for ( size_t i = 0; i < map->data.models.size(); ++i )
-	{
-		ScaleCoords( map->data.models[ i ].boxMax,
-			( float ) map->GetScaleFactor() );
-		ScaleCoords( map->data.models[ i ].boxMin,
-			( float ) map->GetScaleFactor() );
+	TransformLump( map->data.nodes, bounds,
+		[ iscale ]( bspNode_t& node, mapBounds_t& b )
+		{
+			node.boxMax = ScaleSwizzle( node.boxMax, iscale );
+			node.boxMin = ScaleSwizzle( node.boxMin, iscale );
 
-		Q3Bsp_SwizzleCoords( map->data.models[ i ].boxMax );
-		Q3Bsp_SwizzleCoords( map->data.models[ i ].boxMin );
+			b.Enclose( node.boxMax );
+			b.Enclose( node.boxMin );
+		}
+	);
 
-		TestMaxMin( maxPoint, minPoint, map->data.models[ i ].boxMax );
-		TestMaxMin( maxPoint, minPoint, map->data.models[ i ].boxMin );
-	}
+	TransformLump( map->data.leaves, bounds,
+		[ iscale ]( bspLeaf_t& leaf, mapBounds_t& b )
+		{
+			leaf.boxMax = ScaleSwizzle( leaf.boxMax, iscale );
+			leaf.boxMin = ScaleSwizzle( leaf.boxMin, iscale );
 
-	for ( size_t i = 0; i < map->data.faces.size(); ++i )
-	{
-		bspFace_t& face = map->data.faces[ i ];
+			b.Enclose( leaf.boxMax );
+			b.Enclose( leaf.boxMin );
+		}
+	);
 
-		ScaleCoords( face.normal, ( float ) map->GetScaleFactor() );
+	TransformLump( map->data.planes, bounds,
+		[ iscale, scale ]( bspPlane_t& plane, mapBounds_t& b )
+		{
+			plane.distance *= iscale;
+			plane.normal = ScaleSwizzle( plane.normal, scale );
 
-		ScaleCoords( face.lightmapOrigin, ( float ) map->GetScaleFactor() );
+			b.Enclose( plane.normal );
+		}
+	);
 
-		ScaleCoords( face.lightmapStVecs[ 0 ],
-			( float ) map->GetScaleFactor() );
-		ScaleCoords( face.lightmapStVecs[ 1 ],
-			( float ) map->GetScaleFactor() );
+	TransformLump( map->data.vertexes, bounds,
+		[ scale ]( bspVertex_t& vertex, mapBounds_t& b )
+		{
+			vertex.texCoords[ 0 ] *= scale;
+			vertex.texCoords[ 1 ] *= scale;
 
-		Q3Bsp_SwizzleCoords( face.normal );
-		Q3Bsp_SwizzleCoords( face.lightmapOrigin );
-		Q3Bsp_SwizzleCoords( face.lightmapStVecs[ 0 ] );
-		Q3Bsp_SwizzleCoords( face.lightmapStVecs[ 1 ] );
+			vertex.normal = ScaleSwizzle( vertex.normal, scale );
+			vertex.position = ScaleSwizzle( vertex.position, scale );
 
-		TestMaxMin( maxPoint, minPoint, face.normal );
-		TestMaxMin( maxPoint, minPoint, face.lightmapOrigin );
-		TestMaxMin( maxPoint, minPoint, face.lightmapStVecs[ 0 ] );
-		TestMaxMin( maxPoint, minPoint, face.lightmapStVecs[ 1 ] );
+			b.Enclose( vertex.position );
+			b.Enclose( vertex.normal );
+		}
+	);
 
-		//if ( face.type == BSP_FACE_TYPE_BILLBOARD )
-		//{
-			//MLOG_INFO_ONCE(
-			//	"Billboard: [%u] %s", i, bspFace_t_GetInfoString( &face ).c_str()
-			//);
-		//}
-	}
+	TransformLump( map->data.models, bounds,
+		[ scale ]( bspModel_t& model, mapBounds_t& b )
+		{
+			model.boxMax = ScaleSwizzle( model.boxMax, scale );
+			model.boxMin = ScaleSwizzle( model.boxMin, scale );
+
+			b.Enclose( model.boxMax );
+			b.Enclose( model.boxMin );
+		}
+	);
+
+	TransformLump( map->data.faces, bounds,
+		[ scale ]( bspFace_t& face, mapBounds_t& b )
+		{
+			face.normal = ScaleSwizzle( face.normal, scale );
+			face.lightmapOrigin = ScaleSwizzle( face.lightmapOrigin, scale );
+			face.lightmapStVecs[ 0 ] = ScaleSwizzle( face.lightmapStVecs[ 0 ], scale );
+			face.lightmapStVecs[ 1 ] = ScaleSwizzle( face.lightmapStVecs[ 1 ], scale );
+
+			b.Enclose( face.normal );
+			b.Enclose( face.lightmapOrigin );
+			b.Enclose( face.lightmapStVecs[ 0 ] );
+			b.Enclose( face.lightmapStVecs[ 1 ] );
+		}
+	);
 
 	for ( size_t i = 0; i < map->data.shaders.size(); ++i )
 	{
@@ -420,14 +491,20 @@ static void MapReadFin( Q3BspMap* map )
 		BspData_FixupAssetPath( &map->data.shaders[ i ].name[ 0 ] );
 	}
 
-	gDeformCache.skyHeightOffset = maxPoint.y;
+	gDeformCache.skyHeightOffset = bounds.maxPoint.y;
 
 	//MLOG_INFO(
 	//	"maxPoint Found: %s\n"
 	//	"minPoint Found: %s",
-	//	glm::to_string( maxPoint ).c_str(),
-	//	glm::to_string( minPoint ).c_str()
+	//	glm::to_string( bounds.maxPoint ).c_str(),
+	//	glm::to_string( bounds.minPoint ).c_str()
 	//);
+}
+
+static void MapReadFin( Q3BspMap* map )
+{
+#if defined (WEB_WORKER_CLIENT_MAPREADFIN)
+	MapTransformData( map );
 
 	gFileWebWorker.Await(
 		MapReadFin_UnmountFin,
@@ -441,6 +518,8 @@ static void MapReadFin( Q3BspMap* map )
 #endif // WEB_WORKER_CLIENT_MAPREADFIN
 }
 
+// Receives the header requested by ReadBegin; once it's valid
+// the rest of the file is fetched in one batch.
 static void ReadChunk( char* data, int size, void* param )
 {
 	if ( !data )
@@ -457,71 +536,95 @@ static void ReadChunk( char* data, int size, void* param )
 
 	Q3BspMap* map = ( Q3BspMap* ) param;
 
-	switch ( gBspDesc )
+	if ( size < ( int ) sizeof( map->data.header ) )
 	{
-		// We've just begun, so we validate the header first
-		case -1:
-			memcpy( &map->data.header, data, sizeof( map->data.header ) );
-			if ( !map->Validate() )
-			{
-				MLOG_ERROR( "BSP Map \'%s\' is invalid.",
-					map->GetFileName().c_str() );
-				return;
-			}
+		MLOG_ERROR( "BSP Map \'%s\': header is truncated (%i bytes).",
+			map->GetFileName().c_str(), size );
+		return;
+	}
 
-		// We don't break on purpose above, because we want
-		// to initiate a fetch for the first chunk immediately after
-		default:
+	memcpy( &map->data.header, data, sizeof( map->data.header ) );
 
-			// We're ready to take what was received from the
-			// previous chunk read; -1 implies that
-			// we have nothing, since we've only
-			// just validated the header
-			if ( gBspDesc >= 0 && size )
-			{
-				uint8_t checksum = WAPI_CalcCheckSum( data, size - 1 );
+	if ( !map->Validate() )
+	{
+		MLOG_ERROR( "BSP Map \'%s\' is invalid.",
+			map->GetFileName().c_str() );
+		return;
+	}
 
-				if ( checksum != ( uint8_t ) data[ size - 1 ] )
-				{
-					MLOG_WARNING(
-						"Bad Checksum for BSP LUMP ENTRY %x.\n"
-						"Checksum sent: %x\n"
-						"Checksum tested: %x",
-						(uint32_t)data[size - 1],
-						(uint32_t)checksum
-					);
-				}
+	SendLumpsRequest( map->data.header, map );
+}
 
-				// Checksum is appended to the very end of the buffer;
-				// sending the total size could cause problems
-				gBspAllocTable[ gBspDesc ]( data, map->data, size - 1 );
-			}
+// Each provisional response carries one lump (see wApiLumpHeader_t);
+// the final, empty response marks the end of the stream.
+static void ReadLumpStream( char* data, int size, void* param )
+{
+	if ( !param )
+	{
+		MLOG_ERROR( "%s", "Null param received; bailing..." );
+		return;
+	}
 
-			if ( ++gBspDesc < ( int ) BSP_NUM_ENTRIES )
-			{
-				wApiChunkInfo_t info;
+	Q3BspMap* map = ( Q3BspMap* ) param;
 
-				info.offset = map->data.header.directories[ gBspDesc ].offset;
-				info.size = map->data.header.directories[ gBspDesc ].length;
+	if ( !data || !size )
+	{
+		int expected = 0;
 
-				if ( info.size )
-				{
-					SendRequest( info, map );
-				}
-				// Avoid wasting time by moving to the next
-				// directory if we have nothing to read here
-				else
-				{
-					ReadChunk( data, 0, map );
-				}
-			}
-			else
+		for ( uint32_t i = 0; i < BSP_NUM_ENTRIES; ++i )
+		{
+			if ( map->data.header.directories[ i ].length )
 			{
-				gBspDesc = -1;
-				MapReadFin( map );
+				expected++;
 			}
-			break;
+		}
+
+		if ( gBspLumpsReceived != expected )
+		{
+			MLOG_ERROR( "BSP Map \'%s\': received %i of %i lumps; bailing...",
+				map->GetFileName().c_str(), gBspLumpsReceived, expected );
+			return;
+		}
+
+		MapReadFin( map );
+		return;
+	}
+
+	if ( size <= ( int ) sizeof( wApiLumpHeader_t ) )
+	{
+		MLOG_ERROR( "Lump chunk of %i bytes is too small; bailing...", size );
+		return;
+	}
+
+	uint8_t checksum = WAPI_CalcCheckSum( data, size - 1 );
+
+	if ( checksum != ( uint8_t ) data[ size - 1 ] )
+	{
+		MLOG_WARNING(
+			"Bad Checksum for BSP LUMP ENTRY.\n"
+			"Checksum sent: %x\n"
+			"Checksum tested: %x",
+			(uint32_t)( uint8_t )data[size - 1],
+			(uint32_t)checksum
+		);
+	}
+
+	wApiLumpHeader_t header;
+	memcpy( &header, data, sizeof( header ) );
+
+	if ( header.index >= BSP_NUM_ENTRIES )
+	{
+		MLOG_ERROR( "Lump index %" PRIu32 " is out of range; bailing...",
+			header.index );
+		return;
 	}
+
+	// Checksum is appended to the very end of the buffer;
+	// sending the total size could cause problems
+	gBspAllocTable[ header.index ]( data + sizeof( header ), map->data,
+		size - 1 - ( int ) sizeof( header ) );
+
+	gBspLumpsReceived++;
 }
 
 static void ReadBegin( char* data, int size, void* param )
@@ -1176,6 +1279,9 @@ void Q3BspMap::ZeroData( void )
 	opaqueShaderList.clear();
 	transparentShaderList.clear();
 	effectShaders.clear();
+
+	leafCache.leaf = -1;
+	leafCache.path.clear();
 }
 
 void Q3BspMap::DestroyMap( void )
@@ -1185,6 +1291,10 @@ void Q3BspMap::DestroyMap( void )
 		ZeroData();
 		mapAllocated = false;
 	}
+
+#if defined( Q3BSP_NATIVE_MMAP )
+	UnmapFile();
+#endif
 }
 
 void Q3BspMap::Read( const std::string& filepath, int scale,
@@ -1211,6 +1321,49 @@ void Q3BspMap::Read( const std::string& filepath, int scale,
 	readParams.append( filepath );
        
 	gFileWebWorker.Await( ReadBegin, "ReadMapFile_Begin", readParams, this );
+#elif defined( Q3BSP_NATIVE_MMAP )
+	if ( IsAllocated() )
+	{
+		DestroyMap();
+	}
+
+	payload.reset( new renderPayload_t() );
+
+	for ( gla_atlas_ptr_t& atlas: payload->textureData )
+	{
+		atlas.reset( new gla::atlas_t() );
+	}
+
+	readFinishEvent = finishCallback;
+	scaleFactor = scale;
+	name = File_StripExt( File_StripPath( filepath ) );
+
+	if ( !MapFile( filepath ) )
+	{
+		return;
+	}
+
+	data.header = *mappedFile.header;
+
+	// Same allocators the worker path uses, minus the round trips:
+	// each one reads its lump directly out of the mapping.
+	for ( uint32_t i = 0; i < BSP_NUM_ENTRIES; ++i )
+	{
+		const bspLump_t& dir = data.header.directories[ i ];
+
+		if ( dir.length > 0 )
+		{
+			gBspAllocTable[ i ]( ( char* )( mappedFile.base + dir.offset ),
+				data, dir.length );
+		}
+	}
+
+	MapTransformData( this );
+
+	// There's no worker to read shaders and images through, so the
+	// load finishes with the map data
+	mapAllocated = true;
+	readFinishEvent( this );
 #else
 	UNUSED( filepath );
 	UNUSED( scale );
@@ -1218,6 +1371,118 @@ void Q3BspMap::Read( const std::string& filepath, int scale,
 #endif
 }
 
+#if defined( Q3BSP_NATIVE_MMAP )
+bool Q3BspMap::MapFile( const std::string& filepath )
+{
+	UnmapFile();
+
+	int fd = open( filepath.c_str(), O_RDONLY );
+
+	if ( fd < 0 )
+	{
+		MLOG_ERROR( "Could not open \'%s\'", filepath.c_str() );
+		return false;
+	}
+
+	struct stat st;
+
+	if ( fstat( fd, &st ) < 0 || ( size_t ) st.st_size < sizeof( bspHeader_t ) )
+	{
+		MLOG_ERROR( "\'%s\' is too small to be a BSP file", filepath.c_str() );
+		close( fd );
+		return false;
+	}
+
+	void* mem = mmap( nullptr, ( size_t ) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+	if ( mem == MAP_FAILED )
+	{
+		MLOG_ERROR( "mmap failed for \'%s\'", filepath.c_str() );
+		close( fd );
+		return false;
+	}
+
+	// Lumps are consumed front to back
+	madvise( mem, ( size_t ) st.st_size, MADV_SEQUENTIAL );
+
+	mappedFile.fd = fd;
+	mappedFile.size = ( size_t ) st.st_size;
+	mappedFile.base = ( const uint8_t* ) mem;
+	mappedFile.header = ( const bspHeader_t* ) mem;
+
+	if ( !Q3Bsp_ValidateHeader( *mappedFile.header ) )
+	{
+		MLOG_ERROR( "BSP Map \'%s\' is invalid.", filepath.c_str() );
+		UnmapFile();
+		return false;
+	}
+
+	// Views point straight into the mapping, so every lump has to
+	// be in bounds and aligned well enough to be read in place
+	for ( uint32_t i = 0; i < BSP_NUM_ENTRIES; ++i )
+	{
+		const bspLump_t& dir = mappedFile.header->directories[ i ];
+
+		if ( dir.offset < 0 || dir.length < 0
+			|| ( size_t ) dir.offset + ( size_t ) dir.length > mappedFile.size
+			|| !IS_ALIGN4( dir.offset ) )
+		{
+			MLOG_ERROR( "BSP Map \'%s\': lump %" PRIu32 " is malformed "
+				"(offset: %i, length: %i, file size: " F_SIZE_T ")",
+				filepath.c_str(), i, dir.offset, dir.length, mappedFile.size );
+			UnmapFile();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void Q3BspMap::UnmapFile( void )
+{
+	if ( mappedFile.base )
+	{
+		munmap( ( void* ) mappedFile.base, mappedFile.size );
+	}
+
+	if ( mappedFile.fd >= 0 )
+	{
+		close( mappedFile.fd );
+	}
+
+	mappedFile = bspMappedFile_t();
+}
+
+const bspVisdata_t* Q3BspMap::GetVisdataView( void ) const
+{
+	if ( !IsMapped()
+		|| ( size_t ) mappedFile.header->directories[ BSP_LUMP_VISDATA ].length
+			< sizeof( bspVisdata_t ) )
+	{
+		return nullptr;
+	}
+
+	return GetLumpView< bspVisdata_t >( BSP_LUMP_VISDATA ).data;
+}
+
+bspLumpView_t< uint8_t > Q3BspMap::GetVisBitsetView( void ) const
+{
+	bspLumpView_t< uint8_t > view;
+
+	const bspVisdata_t* vis = GetVisdataView();
+
+	if ( vis )
+	{
+		bspLumpView_t< uint8_t > lump = GetLumpView< uint8_t >( BSP_LUMP_VISDATA );
+
+		view.data = lump.data + sizeof( bspVisdata_t );
+		view.count = lump.count - sizeof( bspVisdata_t );
+	}
+
+	return view;
+}
+#endif // Q3BSP_NATIVE_MMAP
+
 void Q3BspMap::WriteLumpToFile( uint32_t lump )
 {
 	FILE* f = nullptr;
@@ -1244,56 +1509,71 @@ void Q3BspMap::WriteLumpToFile( uint32_t lump )
 
 bool Q3BspMap::Validate( void )
 {
-	if ( data.header.id[ 0 ] != 'I' || data.header.id[ 1 ] != 'B'
-		|| data.header.id[ 2 ] != 'S' || data.header.id[ 3 ] != 'P' )
-	{
-		MLOG_WARNING( "Header ID does NOT match \'IBSP\'. ID read is: %s \n",
-			data.header.id );
-		return false;
-	}
-
-	if ( data.header.version != BSP_Q3_VERSION )
-	{
-		MLOG_WARNING( "Header version does NOT match %i. Version found is %i\n",
-			BSP_Q3_VERSION, data.header.version );
-		return false;
-	}
+	return Q3Bsp_ValidateHeader( data.header );
+}
 
-	return true;
+// If the distance from the point to the plane is >= 0,
+// then the point is in a leaf somewhere in front of the node,
+// otherwise it's behind the node somewhere.
+static INLINE int32_t PlaneSide( const glm::vec4& plane, const glm::vec3& p )
+{
+	return ( glm::dot( glm::vec3( plane ), p ) - plane.w >= 0.0f ) ? 0 : 1;
 }
 
 bspLeaf_t* Q3BspMap::FindClosestLeaf( const glm::vec3& camPos )
 {
+	std::vector< bspLeafPathNode_t >& path = leafCache.path;
+
 	int nodeIndex = 0;
 
-	uint32_t count = 0;
-	while ( nodeIndex >= 0 )
+	if ( leafCache.leaf >= 0 )
 	{
-		const bspNode_t* const node = &data.nodes[ nodeIndex ];
-		const bspPlane_t* const plane = &data.planes[ node->plane ];
-
-		// If the distance from the camera to the plane is >= 0,
-		// then our needed camera data is
-		// in a leaf somewhere in front of this node,
-		// otherwise it's behind the node somewhere.
-		glm::vec3 planeNormal( plane->normal.x, plane->normal.y,
-			plane->normal.z );
+		if ( camPos == leafCache.origin )
+		{
+			return &data.leaves[ leafCache.leaf ];
+		}
 
-		float distance = glm::dot( planeNormal, camPos ) - plane->distance;
+		// Keep the part of the last path camPos is still on the same
+		// side of; if that's all of it, we're still in the same leaf.
+		size_t depth = 0;
 
-		if ( distance >= 0 )
+		while ( depth < path.size() && PlaneSide( path[ depth ].plane, camPos ) == path[ depth ].side )
 		{
-			nodeIndex = node->children[ 0 ];
+			depth++;
 		}
-		else
+
+		leafCache.origin = camPos;
+
+		if ( depth == path.size() )
 		{
-			nodeIndex = node->children[ 1 ];
+			return &data.leaves[ leafCache.leaf ];
 		}
 
-		count++;
+		nodeIndex = path[ depth ].node;
+		path.resize( depth );
+	}
+	else
+	{
+		path.clear();
+	}
+
+	while ( nodeIndex >= 0 )
+	{
+		const bspNode_t* const node = &data.nodes[ nodeIndex ];
+		const bspPlane_t* const plane = &data.planes[ node->plane ];
+
+		bspLeafPathNode_t step;
+		step.plane = glm::vec4( plane->normal, plane->distance );
+		step.node = nodeIndex;
+		step.side = PlaneSide( step.plane, camPos );
+
+		path.push_back( step );
+
+		nodeIndex = node->children[ step.side ];
 	}
 
-	nodeIndex = -( nodeIndex + 1 );
+	leafCache.leaf = -( nodeIndex + 1 );
+	leafCache.origin = camPos;
 
-	return  &data.leaves[ nodeIndex ];
+	return &data.leaves[ leafCache.leaf ];
 }
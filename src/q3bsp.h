@@ -36,6 +36,37 @@ struct pathLinkNode_t
 	pathLinkNode_t* next = nullptr;
 };
 
+// FindClosestLeaf remembers the path it took through the tree last time.
+// Consecutive queries tend to be close together, so usually most of
+// that path still holds and only the subtree below the first node whose
+// plane the camera crossed has to be descended again.
+struct bspLeafPathNode_t
+{
+	glm::vec4	plane;	// xyz: normal, w: distance
+	int32_t		node;
+	int32_t		side;	// index of the child we took
+};
+
+struct bspLeafCache_t
+{
+	int32_t								leaf = -1;
+	glm::vec3							origin;
+	std::vector< bspLeafPathNode_t >	path;
+};
+
+#if defined( Q3BSP_NATIVE_MMAP )
+// Bookkeeping for a .bsp which has been mapped into our
+// address space (read-only, private). The header and every lump
+// are accessed in place through bspLumpView_t.
+struct bspMappedFile_t
+{
+	int						fd = -1;
+	size_t					size = 0;
+	const uint8_t*			base = nullptr;
+	const bspHeader_t*		header = nullptr;
+};
+#endif // Q3BSP_NATIVE_MMAP
+
 class Q3BspMap
 {
 private:
@@ -53,6 +84,12 @@ private:
 
 	std::stack< pathLinkNode_t* > 		pathLinkRoots;
 
+	bspLeafCache_t						leafCache;
+
+#if defined( Q3BSP_NATIVE_MMAP )
+	bspMappedFile_t						mappedFile;
+#endif
+
 	void 						MakeStagePathList( pathLinkNode_t * node );
 
 public:
@@ -109,11 +146,37 @@ public:
 
 	void						ZeroData( void );
 
+	// Reads through the file worker when there is one. Otherwise, with
+	// Q3BSP_NATIVE_MMAP, the file is mapped and its lumps are read
+	// straight out of the mapping, without shaders or images; the
+	// mapping stays open, so the lump views below are usable as well.
 	void						Read( const std::string& filepath, int scale,
 	 								onFinishEvent_t finishCallback );
 
 	void						WriteLumpToFile( uint32_t lump );
 
+#if defined( Q3BSP_NATIVE_MMAP )
+	// Only maps and validates the file; no lump data is copied.
+	// Read uses this, and headless tools which just need to read the
+	// lumps can call it directly.
+	bool						MapFile( const std::string& filepath );
+
+	void						UnmapFile( void );
+
+	bool						IsMapped( void ) const
+									{ return mappedFile.base != nullptr; }
+
+	// Raw, unswizzled lump contents straight from the mapping.
+	// Returns an empty view if nothing is mapped.
+	template < typename T >
+	bspLumpView_t< T >			GetLumpView( uint32_t lump ) const;
+
+	// The visdata lump is a bspVisdata_t followed by the cluster bitsets.
+	const bspVisdata_t*			GetVisdataView( void ) const;
+
+	bspLumpView_t< uint8_t >	GetVisBitsetView( void ) const;
+#endif // Q3BSP_NATIVE_MMAP
+
 	bspLeaf_t*					FindClosestLeaf( const glm::vec3& camPos );
 
 	void 						MakeAllocated( void )
@@ -151,6 +214,8 @@ void Q3BspMapTest_ShaderNameTagMain( const char* name );
 void Q3BspMapTest_ShaderNameTagShader( const char* name );
 void Q3BspMapTest_ShaderNameRun( void );
 
+bool Q3Bsp_ValidateHeader( const bspHeader_t& header );
+
 void Q3Bsp_SwizzleCoords( glm::vec3& v );
 void Q3Bsp_SwizzleCoords( glm::ivec3& v );
 void Q3Bsp_SwizzleCoords( glm::vec2& v );
@@ -171,3 +236,25 @@ static INLINE bool Q3Bsp_MatchShaderInfoFromName( const std::vector< T >& list,
 
 	return false;
 }
+
+#if defined( Q3BSP_NATIVE_MMAP )
+template < typename T >
+bspLumpView_t< T > Q3BspMap::GetLumpView( uint32_t lump ) const
+{
+	bspLumpView_t< T > view;
+
+	if ( !IsMapped() || lump >= BSP_NUM_ENTRIES )
+	{
+		return view;
+	}
+
+	// MapFile has already checked that every lump
+	// lies within the file and is suitably aligned
+	const bspLump_t& dir = mappedFile.header->directories[ lump ];
+
+	view.data = ( const T* )( mappedFile.base + dir.offset );
+	view.count = ( size_t ) dir.length / sizeof( T );
+
+	return view;
+}
+#endif // Q3BSP_NATIVE_MMAP
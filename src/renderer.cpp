@@ -5,7 +5,11 @@
 #include "effect_shader.h"
 #include "deform.h"
 #include "model.h"
+#include "map_cache.h"
+#include "lib/parallel.h"
+#include "lib/radix_sort.h"
 #include "renderer/shader_gen.h"
+#include "renderer/program_cache.h"
 #include "renderer/context_window.h"
 #include "extern/gl_atlas.h"
 #include <glm/gtx/string_cast.hpp>
@@ -48,11 +52,22 @@ struct logEffectPass_t
 	}
 };
 
+// Constructing the stringstream allocates, and this is
+// instantiated for every effect pass drawn
+template <>
+struct logEffectPass_t< false >
+{
+	logEffectPass_t( const shaderInfo_t* shader ) { UNUSED( shader ); }
+
+	void Push( int i, const shaderStage_t& stage ) { UNUSED( i ); UNUSED( stage ); }
+};
+
 struct config_t
 {
 	bool drawFacesOnly: 1;
 	bool drawAtlasTextureBoxes: 1;
 	bool logStageTexCoordData: 1;
+	bool useMapCache: 1;
 	bool debugRender;
 };
 
@@ -61,6 +76,7 @@ static config_t gConfig =
 	true,
 	false,
 	false,
+	true,
 	false
 };
 
@@ -70,33 +86,80 @@ struct counts_t
 	uint32_t numSolidNormal;
 	uint32_t numTransEffect;
 	uint32_t numTransNormal;
+	uint32_t numDraws;			// calls to DrawFace
+	uint32_t numBatchedFaces;	// faces drawn as part of a merged run
+};
+
+static counts_t gCounts = { 0, 0, 0, 0, 0, 0 };
+
+// Faces per span when generating vertex data; patches dominate the cost
+enum
+{
+	FACE_GEN_GRAIN = 64
 };
 
-static counts_t gCounts = { 0, 0, 0, 0 };
 static uint64_t frameCount = 0;
 
 //--------------------------------------------------------------
 // drawPass_t
 //--------------------------------------------------------------
-drawPass_t::drawPass_t( const Q3BspMap& map, const viewParams_t& viewData )
+drawPass_t::drawPass_t( void )
 	: isSolid( true ),
 	  envmap( false ),
-	  faceIndex( 0 ), viewLeafIndex( 0 ),
+	  faceIndex( 0 ),
 	  type( PASS_DRAW ), drawType( PASS_DRAW_MAIN ),
 	  renderFlags( 0 ),
 	  face( nullptr ),
+	  farBrush( nullptr ),
 	  leaf( nullptr ),
 	  lightvol( nullptr ),
 	  shader( nullptr ),
-	  view( viewData ),
+	  minFaceViewDepth( 0.0f ), maxFaceViewDepth( 0.0f ),
 	  skyShader( nullptr ),
 	  isDebugDraw( false ),
 	  debugDrawCallback( nullptr ),
-	  debugProgram( nullptr )
+	  debugProgram( nullptr ),
+	  visitStamp( 0 ),
+	  batch( nullptr )
+{
+}
 
+// Resets everything for a new frame. The face lists keep their capacity,
+// and the visited lists are invalidated by bumping visitStamp instead
+// of being cleared, so none of this allocates in steady state.
+void drawPass_t::Begin( const Q3BspMap& map, const viewParams_t& viewData )
 {
-	opaqueFacesVisited.resize( map.data.numFaces, false );
-	transparentFacesVisited.resize( map.data.numFaces, false );
+	isSolid = true;
+	envmap = false;
+	faceIndex = 0;
+	type = PASS_DRAW;
+	drawType = PASS_DRAW_MAIN;
+	renderFlags = 0;
+	face = nullptr;
+	farBrush = nullptr;
+	leaf = nullptr;
+	lightvol = nullptr;
+	shader = nullptr;
+	view = viewData;
+	minFaceViewDepth = maxFaceViewDepth = 0.0f;
+	skyShader = nullptr;
+	isDebugDraw = false;
+	debugDrawCallback = nullptr;
+	debugProgram = nullptr;
+	batch = nullptr;
+
+	skyFaces.clear();
+	opaqueFaces.clear();
+	transparentFaces.clear();
+
+	size_t numFaces = ( size_t ) map.data.numFaces;
+
+	if ( opaqueFacesVisited.size() != numFaces || ++visitStamp == 0 )
+	{
+		opaqueFacesVisited.assign( numFaces, 0 );
+		transparentFacesVisited.assign( numFaces, 0 );
+		visitStamp = 1;
+	}
 }
 
 //--------------------------------------------------------------
@@ -161,7 +224,7 @@ RenderBase::~RenderBase( void )
 //--------------------------------------------------------------
 BSPRenderer::BSPRenderer( float viewWidth, float viewHeight, Q3BspMap& map_ )
 	:	RenderBase( viewWidth, viewHeight ),
-
+		batchIndexBuffer( 0 ),
 		glEffects( {
 			{
 				"tcModTurb",
@@ -174,30 +237,30 @@ BSPRenderer::BSPRenderer( float viewWidth, float viewHeight, Q3BspMap& map_ )
 					GetTimeSeconds(),
 					e.data.wave.frequency,
 					e.data.wave.amplitude );
-					p.LoadFloat( "tcModTurb", turb );
+					p.LoadFloat( UNIFORM_TC_MOD_TURB, turb );
 				}
 			},
 			{
 				"tcModScale",
 				[]( const Program& p, const effect_t& e ) -> void
 				{
-					p.LoadMat2( "tcModScale", &e.data.scale2D[ 0 ][ 0 ] );
+					p.LoadMat2( UNIFORM_TC_MOD_SCALE, &e.data.scale2D[ 0 ][ 0 ] );
 				}
 			},
 			{
 				"tcModScroll",
 				[]( const Program& p, const effect_t& e ) -> void
 				{
-					p.LoadVec4( "tcModScroll", e.data.xyzw );
+					p.LoadVec4( UNIFORM_TC_MOD_SCROLL, e.data.xyzw );
 				}
 			},
 			{
 				"tcModRotate",
 				[]( const Program& p, const effect_t& e ) -> void
 				{
-					p.LoadMat2( "texRotate",
+					p.LoadMat2( UNIFORM_TEX_ROTATE,
 						&e.data.rotation2D.transform[ 0 ][ 0 ] );
-					p.LoadVec2( "texCenter", e.data.rotation2D.center );
+					p.LoadVec2( UNIFORM_TEX_CENTER, e.data.rotation2D.center );
 				}
 			}
 		} ),
@@ -213,6 +276,7 @@ BSPRenderer::BSPRenderer( float viewWidth, float viewHeight, Q3BspMap& map_ )
 
 BSPRenderer::~BSPRenderer( void )
 {
+	DeleteBufferObject( GL_ELEMENT_ARRAY_BUFFER, batchIndexBuffer );
 }
 
 // -------------------------------
@@ -252,11 +316,12 @@ void BSPRenderer::Prep( void )
 {
 	GEnableDepthBuffer();
 
-	GL_CHECK( glEnable( GL_BLEND ) );
+	GS_Enable( GL_BLEND );
 
 	GL_CHECK( glClearColor( 0.0f, 0.0f, 0.0f, 0.0f ) );
 
 	GL_CHECK( glGenBuffers( apiHandles.size(), &apiHandles[ 0 ] ) );
+	GL_CHECK( glGenBuffers( 1, &batchIndexBuffer ) );
 
 	// Load main shader glPrograms
 	{
@@ -305,6 +370,24 @@ static void AddWhiteImage( gla_atlas_ptr_t& atlas )
 	);
 }
 
+// Uses the cached layout if there is one, and runs the packer otherwise
+static void GenAtlasLayers( gla::atlas_t& atlas, const gla::atlas_layout_t* layout )
+{
+	if ( !layout || !gla::gen_atlas_layers_from_layout( atlas, *layout ) )
+	{
+		gla::atlas_pack_stats_t stats = gla::gen_atlas_layers( atlas );
+
+		MLOG_INFO( "Atlas packed by %s: %u images in %u layers, %.1f%% used, %.3f ms",
+			stats.packer,
+			atlas.num_images,
+			stats.num_layers,
+			stats.efficiency * 100.0f,
+			stats.milliseconds );
+	}
+
+	atlas.default_image = atlas.num_images - 1;
+}
+
 void BSPRenderer::Load( renderPayload_t& payload )
 {
 	Prep();
@@ -318,96 +401,158 @@ void BSPRenderer::Load( renderPayload_t& payload )
 	// White images for both the shaders and main atlasses
 	// are dummy fallbacks for erronous image indices / invalid image paths
 	AddWhiteImage( textures[ TEXTURE_ATLAS_SHADERS ] );
-	gla::gen_atlas_layers( *( textures[ TEXTURE_ATLAS_SHADERS ] ) );
-	textures[ TEXTURE_ATLAS_SHADERS ]->default_image =
-		textures[ TEXTURE_ATLAS_SHADERS ]->num_images - 1;
-
 	AddWhiteImage( textures[ TEXTURE_ATLAS_MAIN ] );
-	gla::gen_atlas_layers( *( textures[ TEXTURE_ATLAS_MAIN ] ) );
-	textures[ TEXTURE_ATLAS_MAIN ]->default_image =
-		textures[ TEXTURE_ATLAS_MAIN ]->num_images - 1;
-
-	// Iterate through lightmaps and generate corresponding
-	// texture data
-	size_t lightmapSize = BSP_LIGHTMAP_WIDTH * BSP_LIGHTMAP_HEIGHT * 3;
-
-	for ( bspLightmap_t& lightmap: map.data.lightmaps )
-	{
-		uint8_t* bytes = &lightmap.map[ 0 ][ 0 ][ 0 ];
-		for ( size_t i = 0; i < lightmapSize; i += 3 )
-		{
-			gla::brighten_rgb( &bytes[ i ] );
- 		}
-
-		gla::push_atlas_image(
-			*( textures[ TEXTURE_ATLAS_LIGHTMAPS ] ),
-			bytes,
-			BSP_LIGHTMAP_WIDTH,
-			BSP_LIGHTMAP_HEIGHT,
-			3,
-			GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA,
-			false
-		);
+
+	// Lightmaps are written straight into atlas storage, which is
+	// all reserved up front so they can be filled in parallel
+	{
+		static const guLightmapIngest_t tables;
+
+		std::vector< uint8_t* > lightmapPixels( map.data.lightmaps.size() );
+
+		for ( uint8_t*& pixels: lightmapPixels )
+		{
+			pixels = gla::push_atlas_image_storage(
+				*( textures[ TEXTURE_ATLAS_LIGHTMAPS ] ),
+				BSP_LIGHTMAP_WIDTH,
+				BSP_LIGHTMAP_HEIGHT
+			);
+		}
+
+		Parallel_For( lightmapPixels.size(), 16,
+			[ this, &lightmapPixels ]( size_t begin, size_t end, uint32_t span )
+		{
+			UNUSED( span );
+
+			for ( size_t i = begin; i < end; ++i )
+			{
+				GU_IngestLightmap( tables, map.data.lightmaps[ i ], lightmapPixels[ i ] );
+			}
+		} );
 	}
 
 	// Sometimes a white image is explicitly desired for certain shader passes;
 	// this will also serve as a fallback if needed.
 	AddWhiteImage( textures[ TEXTURE_ATLAS_LIGHTMAPS ] );
-	gla::gen_atlas_layers( *( textures[ TEXTURE_ATLAS_LIGHTMAPS ] ) );
-	textures[ TEXTURE_ATLAS_LIGHTMAPS ]->default_image =
-		textures[ TEXTURE_ATLAS_LIGHTMAPS ]->num_images - 1;
+
+	// Every image has been pushed at this point, so the
+	// cache key can account for all of them
+#if defined( MAP_CACHE_ENABLED )
+	const gla::atlas_t* atlases[ MAP_CACHE_NUM_ATLASES ] =
+	{
+		textures[ TEXTURE_ATLAS_SHADERS ].get(),
+		textures[ TEXTURE_ATLAS_MAIN ].get(),
+		textures[ TEXTURE_ATLAS_LIGHTMAPS ].get()
+	};
+
+	mapCache_t cache;
+	uint64_t cacheKey = 0;
+
+	if ( gConfig.useMapCache )
+	{
+		cacheKey = MapCache_MakeKey( map, atlases );
+
+		if ( MapCache_Open( cache, MapCache_GetPath( map ), cacheKey, map )
+			&& !MapCache_ApplyShaderOrder( cache, map ) )
+		{
+			MLOG_INFO( "%s", "Map cache doesn't match the loaded map; regenerating it" );
+			MapCache_Close( cache );
+		}
+	}
+#endif
+
+	for ( int32_t i = TEXTURE_ATLAS_SHADERS; i <= TEXTURE_ATLAS_LIGHTMAPS; ++i )
+	{
+		const gla::atlas_layout_t* layout = nullptr;
+
+#if defined( MAP_CACHE_ENABLED )
+		if ( cache.IsOpen() )
+		{
+			layout = cache.atlasLayouts[ i ].get();
+		}
+#endif
+
+		GenAtlasLayers( *( textures[ i ] ), layout );
+	}
 
 	GL_CHECK( glPixelStorei( GL_UNPACK_ALIGNMENT, oldAlign ) );
 
 	camera->SetViewOrigin( map.GetFirstSpawnPoint().origin );
 
-	LoadVertexData();
+#if defined( MAP_CACHE_ENABLED )
+	if ( cache.IsOpen() && !LoadCachedVertexData( cache ) )
+	{
+		MLOG_INFO( "%s", "Map cache patch LODs don't match the loaded map; regenerating it" );
+		MapCache_Close( cache );
+	}
 
-	// Basic program setup
-	for ( const auto& iShader: map.effectShaders )
+	if ( !cache.IsOpen() )
+#endif
 	{
-		for ( const shaderStage_t& stage: iShader.second.stageBuffer )
+		std::vector< bspVertex_t > vertexData;
+		gIndexBuffer_t indexData;
+
+		GenVertexData( vertexData, indexData );
+
+		UploadVertexData( vertexData, indexData );
+
+#if defined( MAP_CACHE_ENABLED )
+		if ( gConfig.useMapCache )
 		{
-			stage.GetProgram().LoadMat4( "viewToClip",
-				camera->ViewData().clipTransform );
+			MapCache_Write( MapCache_GetPath( map ), cacheKey, map, vertexData,
+				indexData, glFaces, atlases );
 		}
+#endif
+	}
+
+	LoadClusterFaceLists();
+
+	LinkPatchLodGroups();
+
+	viewCache.valid = false;
+
+	// Basic program setup; stages share programs, so this
+	// goes through the store rather than the stages
+	for ( uint32_t i = 0; i < ( uint32_t ) GNumPrograms(); ++i )
+	{
+		GQueryProgram( { i } )->LoadMat4( UNIFORM_VIEW_TO_CLIP,
+			camera->ViewData().clipTransform );
 	}
 
-	printf( "Program Count: %i\n", static_cast<int32_t>(GNumPrograms()) );
+	gProgramStats_t programStats( GProgramStats() );
+
+	MLOG_INFO( "Programs: %u unique, %u requested",
+		programStats.unique, programStats.requested );
 
-	glPrograms[ "main" ]->LoadMat4( "viewToClip",
+#if defined( PROGRAM_CACHE_ENABLED )
+	programCacheStats_t cacheStats( ProgramCache_Stats() );
+
+	MLOG_INFO( "Program binary cache: %u hits, %u misses, %u stored",
+		cacheStats.hits, cacheStats.misses, cacheStats.stores );
+#endif
+
+	glPrograms[ "main" ]->LoadMat4( UNIFORM_VIEW_TO_CLIP,
 		camera->ViewData().clipTransform );
 
 	GPrintContextInfo();
 }
 
-void BSPRenderer::LoadVertexData( void )
+void BSPRenderer::GenVertexData( std::vector< bspVertex_t >& vertexData,
+	gIndexBuffer_t& indexData )
 {
 	glFaces.resize( map.data.numFaces );
 
 	if ( gConfig.debugRender )
 		glDebugFaces.resize( map.data.numFaces );
 
-	std::vector< bspVertex_t > vertexData(
+	vertexData.assign(
 		&map.data.vertexes[ 0 ],
 		&map.data.vertexes[ map.data.numVertexes ]
 	);
 
-#if G_STREAM_INDEX_VALUES
-	size_t iboSize = 0;
-#else
-	std::vector< uint32_t > indexData;
-	MapModelGenIndexBuffer( indexData );
-#endif
-
-	// cache the data already used for any polygon or mesh faces, so we don't have to
-	// iterate through their index/vertex mapping every frame. For faces
-	// which aren't of these two categories, we leave them be.
-	for ( int32_t i = 0; i < map.data.numFaces; ++i )
+	auto LGenerateFace = [ this ]( std::vector< bspVertex_t >& vertices, int32_t i )
 	{
-		const bspFace_t* face = &map.data.faces[ i ];
-
-		if ( face->type == BSP_FACE_TYPE_PATCH )
+		if ( map.data.faces[ i ].type == BSP_FACE_TYPE_PATCH )
 		{
 			glFaces[ i ].reset( new mapPatch_t() );
 		}
@@ -416,17 +561,116 @@ void BSPRenderer::LoadVertexData( void )
 			glFaces[ i ].reset( new mapModel_t() );
 		}
 
-		glFaces[ i ]->Generate( vertexData, &map, i );
+		glFaces[ i ]->Generate( vertices, &map, i );
 		glFaces[ i ]->CalcBounds( map.data );
+	};
 
+	// cache the data already used for any polygon or mesh faces, so we don't have to
+	// iterate through their index/vertex mapping every frame. For faces
+	// which aren't of these two categories, we leave them be.
 #if G_STREAM_INDEX_VALUES
+	UNUSED( indexData );
+	size_t iboSize = 0;
+
+	// Each face's indices go to its own buffer object here,
+	// which isn't safe to do from more than one thread
+	for ( int32_t i = 0; i < map.data.numFaces; ++i )
+	{
+		LGenerateFace( vertexData, i );
+
 		// Allocate the largest index buffer out of all models, so we can just
 		// stream each item, and save GPU mallocs
 		if ( iboSize < glFaces[ i ]->iboRange )
 		{
 			iboSize = glFaces[ i ]->iboRange;
 		}
+	}
+#else
+	// Spans of faces are generated in parallel, each into vertex and index
+	// lists of its own, as though its first face were the first in the map.
+	// A prefix sum over the spans' sizes then gives each span its place in
+	// the final buffers, and shifts its faces' offsets and patch indices to
+	// match. Spans are contiguous and in face order, so the result is
+	// identical to generating every face in one serial pass.
+	struct faceGenSpan_t
+	{
+		std::vector< bspVertex_t > vertices;
+		gIndexBuffer_t indices;
+
+		size_t vertexBase = 0;
+		size_t indexBase = 0;
+	};
+
+	std::array< faceGenSpan_t, PARALLEL_MAX_SPANS > spans;
+
+	const size_t numFaces = ( size_t ) map.data.numFaces;
+	const uint32_t numSpans = Parallel_NumSpans( numFaces, FACE_GEN_GRAIN );
+
+	Parallel_For( numFaces, FACE_GEN_GRAIN,
+		[ &spans, &LGenerateFace ]( size_t begin, size_t end, uint32_t s )
+		{
+			MapModelGenIndexBuffer( &spans[ s ].indices );
+
+			for ( size_t i = begin; i < end; ++i )
+			{
+				LGenerateFace( spans[ s ].vertices, ( int32_t ) i );
+			}
+
+			MapModelGenIndexBuffer( nullptr );
+		}
+	);
+
+	size_t vertexBase = vertexData.size();
+	size_t indexBase = indexData.size();
+
+	for ( uint32_t s = 0; s < numSpans; ++s )
+	{
+		spans[ s ].vertexBase = vertexBase;
+		spans[ s ].indexBase = indexBase;
+
+		vertexBase += spans[ s ].vertices.size();
+		indexBase += spans[ s ].indices.size();
+	}
+
+	vertexData.resize( vertexBase );
+	indexData.resize( indexBase );
+
+	Parallel_For( numFaces, FACE_GEN_GRAIN,
+		[ this, &spans, &vertexData, &indexData ]( size_t begin, size_t end, uint32_t s )
+		{
+			faceGenSpan_t& span = spans[ s ];
+
+			for ( size_t i = begin; i < end; ++i )
+			{
+				mapModel_t& model = *glFaces[ i ];
+
+				// Only patches own vertices past the map's; everything else
+				// indexes the map's vertices directly and has nothing to shift
+				if ( map.data.faces[ i ].type == BSP_FACE_TYPE_PATCH )
+				{
+					mapPatch_t& patch = *( model.ToPatch() );
+
+					for ( GLsizei k = 0; k < patch.iboRange; ++k )
+					{
+						span.indices[ patch.iboOffset + k ] += ( gIndex_t ) span.vertexBase;
+					}
+
+					patch.vboOffset += ( GLuint ) span.vertexBase;
+				}
+
+				model.iboOffset += ( intptr_t ) span.indexBase;
+			}
+
+			std::copy( span.vertices.begin(), span.vertices.end(),
+				vertexData.begin() + span.vertexBase );
+			std::copy( span.indices.begin(), span.indices.end(),
+				indexData.begin() + span.indexBase );
+		}
+	);
 #endif
+
+	for ( int32_t i = 0; i < map.data.numFaces; ++i )
+	{
 		if ( gConfig.debugRender )
 		{
 			MLOG_ASSERT( false, "gConfig.debugRender is true; you need to add the"\
@@ -440,21 +684,378 @@ void BSPRenderer::LoadVertexData( void )
 			glDebugFaces[ i ].color = color;
 		}
 	}
+}
 
+void BSPRenderer::UploadVertexData( const bspLumpView_t< bspVertex_t >& vertexData,
+	const bspLumpView_t< gIndex_t >& indexData )
+{
 	// Allocate vertex data from map and store it all in a single vbo;
 	// we use dynamic draw as a hint, considering that vertex deforms
 	// require a buffer update
-	GL_CHECK( glBindBuffer( GL_ARRAY_BUFFER, apiHandles[ 0 ] ) );
+	GS_BindBuffer( GL_ARRAY_BUFFER, apiHandles[ 0 ] );
 	GL_CHECK( glBufferData( GL_ARRAY_BUFFER, sizeof( vertexData[ 0 ] )
-		* vertexData.size(), &vertexData[ 0 ], GL_DYNAMIC_DRAW ) );
+		* vertexData.size(), vertexData.data, GL_DYNAMIC_DRAW ) );
 
-#if !G_STREAM_INDEX_VALUES
-	GL_CHECK( glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, apiHandles[ 1 ] ) );
+#if G_STREAM_INDEX_VALUES
+	UNUSED( indexData );
+#else
+	GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, apiHandles[ 1 ] );
 	GL_CHECK( glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof( indexData[ 0 ] )
-		* indexData.size(), &indexData[ 0 ], GL_STATIC_DRAW ) );
+		* indexData.size(), indexData.data, GL_STATIC_DRAW ) );
+
+	clientIndices.assign( indexData.data, indexData.data + indexData.size() );
 #endif
 }
 
+void BSPRenderer::UploadVertexData( const std::vector< bspVertex_t >& vertexData,
+	const gIndexBuffer_t& indexData )
+{
+	UploadVertexData(
+		bspLumpView_t< bspVertex_t >{ vertexData.data(), vertexData.size() },
+		bspLumpView_t< gIndex_t >{ indexData.data(), indexData.size() }
+	);
+}
+
+#if defined( MAP_CACHE_ENABLED )
+// Rebuilds glFaces from the cache's face records; the vertex and
+// index data are uploaded straight out of the mapping. Returns false,
+// with nothing uploaded, if a patch's LODs don't cover its cached
+// index range.
+bool BSPRenderer::LoadCachedVertexData( const mapCache_t& cache )
+{
+	glFaces.resize( map.data.numFaces );
+
+	for ( int32_t i = 0; i < map.data.numFaces; ++i )
+	{
+		const mapCacheFace_t& record = cache.faces[ i ];
+		mapModel_t* model;
+
+		if ( map.data.faces[ i ].type == BSP_FACE_TYPE_PATCH )
+		{
+			model = new mapPatch_t();
+		}
+		else
+		{
+			model = new mapModel_t();
+		}
+
+		glFaces[ i ].reset( model );
+
+		model->shader = map.GetShaderInfo( i );
+		model->vboOffset = record.vboOffset;
+		model->iboOffset = record.iboOffset;
+		model->iboRange = record.iboRange;
+		model->subdivLevel = record.subdivLevel;
+		model->bounds = AABB( record.boundsMax, record.boundsMin );
+
+		if ( map.data.faces[ i ].type == BSP_FACE_TYPE_PATCH )
+		{
+			mapPatch_t* patch = model->ToPatch();
+
+			patch->SetupLods( map.data.faces[ i ] );
+
+			const patchLod_t& coarsest = patch->lods[ patch->numLods - 1 ];
+
+			if ( ( GLsizei ) coarsest.indexOffset + coarsest.numIndices != record.iboRange )
+			{
+				glFaces.clear();
+				return false;
+			}
+		}
+
+		model->clientVertices.assign(
+			cache.clientVertexes.begin() + record.clientVertexOffset,
+			cache.clientVertexes.begin() + record.clientVertexOffset + record.numClientVertices
+		);
+	}
+
+	UploadVertexData( cache.vertexes, cache.indexes );
+
+	MLOG_INFO( "Loaded %i faces from the map cache", map.data.numFaces );
+
+	return true;
+}
+#endif
+
+void BSPRenderer::LoadClusterFaceLists( void )
+{
+	const mapData_t& data = map.data;
+
+	clusterFaces.numClusters = data.bitsetSrc.empty() ? 0 : data.visdata.numVectors;
+	clusterFaces.faceKeys.assign( data.numFaces, drawFace_t() );
+	clusterFaces.faceCenters.assign( data.numFaces, glm::vec4( 0.0f ) );
+	clusterFaces.faceExtents.assign( data.numFaces, glm::vec4( 0.0f ) );
+
+	for ( int32_t i = 0; i < data.numFaces; ++i )
+	{
+		const AABB& bounds = glFaces[ i ]->bounds;
+
+		if ( glFaces[ i ]->iboRange && glm::all( glm::lessThanEqual( bounds.minPoint, bounds.maxPoint ) ) )
+		{
+			clusterFaces.faceCenters[ i ] = glm::vec4( bounds.Center(), 1.0f );
+			clusterFaces.faceExtents[ i ] = glm::vec4( ( bounds.maxPoint - bounds.minPoint ) * 0.5f, 0.0f );
+		}
+	}
+
+	// Same filtering and keys ProcessFace uses. Faces without any indices
+	// have nothing to draw, and no bounds to cull against either.
+	std::vector< uint8_t > drawable( data.numFaces, 0 );
+
+	for ( int32_t i = 0; i < data.numFaces; ++i )
+	{
+		const shaderInfo_t* shader = map.GetShaderInfo( i );
+
+		if ( map.IsNoDrawShader( shader ) || map.IsSkyShader( shader )
+			|| !glFaces[ i ]->iboRange )
+		{
+			continue;
+		}
+
+		drawFace_t& dface = clusterFaces.faceKeys[ i ];
+
+		dface.SetTransparent( map.IsTransparentShader( shader ) );
+		dface.SetMapFaceIndex( i );
+		dface.SetShaderListIndex( shader->sortListIndex );
+
+		drawable[ i ] = 1;
+	}
+
+	// Bucket leaves by cluster, so each list only has to
+	// visit the leaves of the clusters it can see
+	int32_t numClusters = clusterFaces.numClusters;
+
+	std::vector< uint32_t > clusterLeafOffsets( numClusters + 1, 0 );
+	std::vector< uint32_t > clusterLeaves;
+
+	for ( const bspLeaf_t& leaf: data.leaves )
+	{
+		if ( leaf.clusterIndex >= 0 && leaf.clusterIndex < numClusters )
+		{
+			clusterLeafOffsets[ leaf.clusterIndex + 1 ]++;
+		}
+	}
+
+	for ( int32_t c = 0; c < numClusters; ++c )
+	{
+		clusterLeafOffsets[ c + 1 ] += clusterLeafOffsets[ c ];
+	}
+
+	{
+		std::vector< uint32_t > cursor( clusterLeafOffsets.begin(), clusterLeafOffsets.end() - 1 );
+		clusterLeaves.resize( clusterLeafOffsets.back() );
+
+		for ( int32_t i = 0; i < data.numLeaves; ++i )
+		{
+			int32_t c = data.leaves[ i ].clusterIndex;
+
+			if ( c >= 0 && c < numClusters )
+			{
+				clusterLeaves[ cursor[ c ]++ ] = ( uint32_t ) i;
+			}
+		}
+	}
+
+	const std::vector< drawFace_t >& keys = clusterFaces.faceKeys;
+
+	auto LSortPredicate = [ &keys ]( uint32_t a, uint32_t b ) -> bool
+	{
+		if ( keys[ a ].sort != keys[ b ].sort )
+		{
+			return keys[ a ].sort < keys[ b ].sort;
+		}
+
+		return keys[ a ].metadata < keys[ b ].metadata;
+	};
+
+	// Lists are independent, so they're built in parallel; every span
+	// fills its own buffers, which are concatenated in span order after.
+	size_t numLists = ( size_t ) numClusters + 1;
+
+	std::array< std::vector< uint32_t >, PARALLEL_MAX_SPANS > spanFaces;
+	std::array< std::vector< uint32_t >, PARALLEL_MAX_SPANS > spanCounts;
+
+	Parallel_For( numLists, 16, [ & ]( size_t begin, size_t end, uint32_t span )
+	{
+		// stamps[ face ] == list + 1 if face has already been added to list
+		std::vector< uint32_t > stamps( data.numFaces, 0 );
+
+		std::vector< uint32_t >& out = spanFaces[ span ];
+
+		auto LAddLeaf = [ & ]( const bspLeaf_t& leaf, uint32_t stamp )
+		{
+			for ( int32_t f = 0; f < leaf.numLeafFaces; ++f )
+			{
+				int32_t index = data.leafFaces[ leaf.leafFaceOffset + f ].index;
+
+				if ( drawable[ index ] && stamps[ index ] != stamp )
+				{
+					stamps[ index ] = stamp;
+					out.push_back( ( uint32_t ) index );
+				}
+			}
+		};
+
+		for ( size_t list = begin; list < end; ++list )
+		{
+			size_t listBegin = out.size();
+			uint32_t stamp = ( uint32_t ) list + 1;
+
+			if ( list == ( size_t ) numClusters )
+			{
+				for ( const bspLeaf_t& leaf: data.leaves )
+				{
+					LAddLeaf( leaf, stamp );
+				}
+			}
+			else
+			{
+				const uint8_t* visSet = &data.bitsetSrc[ list * data.visdata.sizeVector ];
+
+				for ( int32_t c = 0; c < numClusters; ++c )
+				{
+					if ( !( visSet[ c >> 3 ] & ( 1 << ( c & 7 ) ) ) )
+					{
+						continue;
+					}
+
+					for ( uint32_t l = clusterLeafOffsets[ c ]; l < clusterLeafOffsets[ c + 1 ]; ++l )
+					{
+						LAddLeaf( data.leaves[ clusterLeaves[ l ] ], stamp );
+					}
+				}
+			}
+
+			std::sort( out.begin() + listBegin, out.end(), LSortPredicate );
+
+			spanCounts[ span ].push_back( ( uint32_t )( out.size() - listBegin ) );
+		}
+	} );
+
+	clusterFaces.offsets.assign( 1, 0 );
+	clusterFaces.faces.clear();
+
+	for ( uint32_t span = 0; span < PARALLEL_MAX_SPANS; ++span )
+	{
+		clusterFaces.faces.insert( clusterFaces.faces.end(),
+			spanFaces[ span ].begin(), spanFaces[ span ].end() );
+
+		for ( uint32_t count: spanCounts[ span ] )
+		{
+			clusterFaces.offsets.push_back( clusterFaces.offsets.back() + count );
+		}
+	}
+
+	MLOG_INFO( "Cluster face lists: %" PRIu32 " lists, " F_SIZE_T " entries",
+		( uint32_t ) numLists, clusterFaces.faces.size() );
+}
+
+// Patches are linked whenever any of the control points along their
+// borders coincide. A shared edge is evaluated from the same control
+// points on either side, so at the same LOD its vertices match exactly.
+// Single LOD patches (CPU deformed) are left out and keep a group of
+// their own, since they can't follow the rest of a group down.
+void BSPRenderer::LinkPatchLodGroups( void )
+{
+	const mapData_t& data = map.data;
+
+	std::vector< int32_t > parent( data.numFaces );
+
+	for ( int32_t i = 0; i < data.numFaces; ++i )
+	{
+		parent[ i ] = i;
+	}
+
+	auto LFind = [ &parent ]( int32_t i ) -> int32_t
+	{
+		while ( parent[ i ] != i )
+		{
+			parent[ i ] = parent[ parent[ i ] ];
+			i = parent[ i ];
+		}
+
+		return i;
+	};
+
+	// Positions are snapped to an eighth of a unit, 21 bits per axis
+	auto LPointKey = []( const glm::vec3& p ) -> uint64_t
+	{
+		glm::ivec3 q( glm::round( p * 8.0f ) );
+
+		return ( ( uint64_t )( q.x & 0x1FFFFF ) << 42 )
+			| ( ( uint64_t )( q.y & 0x1FFFFF ) << 21 )
+			| ( uint64_t )( q.z & 0x1FFFFF );
+	};
+
+	std::unordered_map< uint64_t, int32_t > firstAtPoint;
+	int32_t numPatches = 0;
+
+	for ( int32_t i = 0; i < data.numFaces; ++i )
+	{
+		const bspFace_t& face = data.faces[ i ];
+
+		if ( face.type != BSP_FACE_TYPE_PATCH )
+		{
+			continue;
+		}
+
+		numPatches++;
+
+		if ( glFaces[ i ]->ToPatch()->numLods == 1 )
+		{
+			continue;
+		}
+
+		int32_t w = face.patchDimensions[ 0 ];
+		int32_t h = face.patchDimensions[ 1 ];
+
+		for ( int32_t y = 0; y < h; ++y )
+		{
+			for ( int32_t x = 0; x < w; ++x )
+			{
+				if ( x != 0 && x != w - 1 && y != 0 && y != h - 1 )
+				{
+					continue;
+				}
+
+				const glm::vec3& p = data.vertexes[ face.vertexOffset + y * w + x ].position;
+
+				auto entry = firstAtPoint.insert( std::make_pair( LPointKey( p ), i ) );
+
+				if ( !entry.second )
+				{
+					parent[ LFind( i ) ] = LFind( entry.first->second );
+				}
+			}
+		}
+	}
+
+	std::vector< int32_t > groupOfRoot( data.numFaces, -1 );
+
+	patchLods.numGroups = 0;
+
+	for ( int32_t i = 0; i < data.numFaces; ++i )
+	{
+		if ( data.faces[ i ].type != BSP_FACE_TYPE_PATCH )
+		{
+			continue;
+		}
+
+		int32_t root = LFind( i );
+
+		if ( groupOfRoot[ root ] < 0 )
+		{
+			groupOfRoot[ root ] = patchLods.numGroups++;
+		}
+
+		glFaces[ i ]->ToPatch()->lodGroup = groupOfRoot[ root ];
+	}
+
+	patchLods.faceLods.assign( data.numFaces, 0 );
+	patchLods.groupLods.assign( patchLods.numGroups, 0 );
+
+	MLOG_INFO( "Patch LOD: %i patches in %i groups", numPatches, patchLods.numGroups );
+}
+
 // -------------------------------
 // Frame
 // -------------------------------
@@ -470,6 +1071,8 @@ void BSPRenderer::Render( void )
 
 	frameTime = GetTimeSeconds() - startTime;
 
+	glStateCounts = GS_TakeCounters();
+
 	frameCount++;
 }
 
@@ -483,8 +1086,15 @@ void BSPRenderer::DrawMapPass(
 	std::function< void( const Program& mainRef ) > callback
 )
 {
-	GL_CHECK( glDepthFunc( GL_LEQUAL ) );
-	GL_CHECK( glBlendFunc( GL_ONE, GL_ZERO ) );
+	GS_DepthFunc( GL_LEQUAL );
+	GS_BlendFunc( GL_ONE, GL_ZERO );
+	GS_DepthMask( GL_TRUE );
+
+	if ( allowFaceCulling )
+	{
+		GS_Enable( GL_CULL_FACE );
+		GS_CullFace( GL_FRONT );
+	}
 
 	const Program& main = *( glPrograms.at( "main" ) );
 
@@ -496,7 +1106,7 @@ void BSPRenderer::DrawMapPass(
 			main,
 			textures[ TEXTURE_ATLAS_LIGHTMAPS ],
 			textures[ TEXTURE_ATLAS_LIGHTMAPS ]->num_images - 1,
-			"mainImage",
+			UNIFORM_MAIN_IMAGE_SAMPLER,
 			0
 		);
 	}
@@ -506,7 +1116,7 @@ void BSPRenderer::DrawMapPass(
 			main,
 			textures[ TEXTURE_ATLAS_MAIN ],
 			textures[ TEXTURE_ATLAS_MAIN ]->key_image( textureIndex ),
-			"mainImage",
+			UNIFORM_MAIN_IMAGE_SAMPLER,
 			0
 		);
 	}
@@ -517,7 +1127,7 @@ void BSPRenderer::DrawMapPass(
 			main,
 			textures[ TEXTURE_ATLAS_LIGHTMAPS ],
 			textures[ TEXTURE_ATLAS_LIGHTMAPS ]->num_images - 1,
-			"lightmap",
+			UNIFORM_LIGHTMAP_SAMPLER,
 			1
 		);
 	}
@@ -527,12 +1137,12 @@ void BSPRenderer::DrawMapPass(
 			main,
 			textures[ TEXTURE_ATLAS_LIGHTMAPS ],
 			lightmapIndex,
-			"lightmap",
+			UNIFORM_LIGHTMAP_SAMPLER,
 			1
 		);
 	}
 
-	main.LoadMat4( "modelToView", camera->ViewData().transform );
+	main.LoadMat4( UNIFORM_MODEL_TO_VIEW, camera->ViewData().transform );
 
 	main.Bind();
 
@@ -540,12 +1150,8 @@ void BSPRenderer::DrawMapPass(
 
 	main.Release();
 
-	// Even if the lightmaps atlas is used in place of the main atlas
-	// (in the case of textureIndex == -1), calling release_from_active_slot()
-	// using the main atlas pointer will still do what it's supposed to do:
-	// activate texture slot 0 and unbind its currently bound texture.
-	textures[ TEXTURE_ATLAS_MAIN ]->release_from_active_slot( 0 );
-	textures[ TEXTURE_ATLAS_LIGHTMAPS ]->release_from_active_slot( 1 );
+	// The textures are left bound: the next draw most likely
+	// binds the same ones, in which case nothing is issued.
 
 	main.DisableDefaultAttribProfiles();
 }
@@ -560,47 +1166,30 @@ void BSPRenderer::DrawEffectPass( const drawTuple_t& data, drawCall_t callback )
 	// so we don't need a second texcoord
 	GL_CHECK( glDisableVertexAttribArray( 3 ) );
 
-	// Assess the current culling situation; if the current
-	// shader uses a setting which differs from what's currently set,
-	// we restore our cull settings to their previous values after this draw
-	GLint oldCull = -1, oldCullMode = 0, oldFrontFace = 0;
-
-	if  ( allowFaceCulling )
+	// Like DrawMapPass, this sets the cull and depth state it needs rather
+	// than restoring what was there before; the state cache drops whatever
+	// turns out to be unchanged.
+	if ( allowFaceCulling )
 	{
-		GL_CHECK( glGetIntegerv( GL_CULL_FACE, &oldCull ) );
-
-		// Store values right now, before the potential change in state
-		if ( oldCull )
-		{
-			GL_CHECK( glGetIntegerv( GL_FRONT_FACE, &oldFrontFace ) );
-			GL_CHECK( glGetIntegerv( GL_CULL_FACE_MODE, &oldCullMode ) );
-		}
-
-		// Check for desired face culling
 		if ( shader->cullFace == GL_NONE )
 		{
-			GL_CHECK( glDisable( GL_CULL_FACE ) );
+			GS_Disable( GL_CULL_FACE );
 		}
 		else
 		{
-			if ( !oldCull ) // Not enabled, so we need to activate it
-				GL_CHECK( glEnable( GL_CULL_FACE ) );
-
-			GL_CHECK( glCullFace( shader->cullFace ) );
+			GS_Enable( GL_CULL_FACE );
+			GS_CullFace( shader->cullFace );
 		}
 	}
 
 	if ( alwaysWriteDepth )
 	{
-		GL_CHECK( glDepthMask( GL_TRUE ) );
+		GS_DepthMask( GL_TRUE );
 	}
 
 	// Set to true to log info after function leaves
 	logEffectPass_t< false > logger( shader );
 
-	// Make sure we have depth func set to LEQUAL before we return.
-	GLenum lastDepth = GL_LEQUAL;
-
 	const viewParams_t& viewData = camera->ViewData();
 
 	// Used primarily for texture scrolling.
@@ -620,22 +1209,25 @@ void BSPRenderer::DrawEffectPass( const drawTuple_t& data, drawCall_t callback )
 			viewTransform *= glm::translate( glm::mat4( 1.0f ), stage.translate );
 		}
 
-		stageProg.LoadMat4( "modelToView", viewTransform );
+		stageProg.LoadMat4( UNIFORM_MODEL_TO_VIEW, viewTransform );
+
+		if ( DeformUsesGPU( shader ) )
+		{
+			const wave_t& wave = shader->deformParms.data.wave;
+
+			stageProg.LoadVec4( UNIFORM_DEFORM_WAVE,
+				glm::vec4( wave.base, wave.amplitude, wave.phase, wave.frequency ) );
+			stageProg.LoadVec4( UNIFORM_DEFORM_PARAMS,
+				glm::vec4( wave.spread, ( float )( shader->deformFn - VERTEXDEFORM_FUNC_TRIANGLE ),
+					deformFrame.time, 0.0f ) );
+		}
 
-		GL_CHECK( glBlendFunc( stage.blendSrc, stage.blendDest ) );
-		GL_CHECK( glDepthFunc( stage.depthFunc ) );
-		lastDepth = stage.depthFunc;
+		GS_BlendFunc( stage.blendSrc, stage.blendDest );
+		GS_DepthFunc( stage.depthFunc );
 
 		if ( !alwaysWriteDepth )
 		{
-			if ( isSolid || stage.depthPass )
-			{
-				GL_CHECK( glDepthMask( GL_TRUE ) );
-			}
-			else
-			{
-				GL_CHECK( glDepthMask( GL_FALSE ) );
-			}
+			GS_DepthMask( ( isSolid || stage.depthPass ) ? GL_TRUE : GL_FALSE );
 		}
 
 		gla_atlas_ptr_t* atlas = nullptr;
@@ -666,7 +1258,7 @@ void BSPRenderer::DrawEffectPass( const drawTuple_t& data, drawCall_t callback )
 			stageProg,
 			*atlas,
 			texIndex,
-			nullptr,
+			UNIFORM_SAMPLER0,
 			0
 		);
 
@@ -702,44 +1294,13 @@ void BSPRenderer::DrawEffectPass( const drawTuple_t& data, drawCall_t callback )
 		callback( std::get< 0 >( data ), stageProg, &stage );
 		stageProg.Release();
 
-		( *atlas )->release_from_active_slot( 0 );
-
 		if ( !stage.deferAttribLayoutLoad )
 		{
 			stageProg.DisableDefaultAttribProfiles();
 		}
 	}
 
-	// No need to change state here unless there's the possibility
-	// we've modified it
-	if ( !alwaysWriteDepth )
-	{
-		GL_CHECK( glDepthMask( GL_TRUE ) );
-	}
-
-	if ( lastDepth != GL_LEQUAL )
-	{
-		GL_CHECK( glDepthFunc( GL_LEQUAL ) );
-	}
-
 	GL_CHECK( glEnableVertexAttribArray( 3 ) );
-
-	// Did we bother checking earlier?
-	if ( allowFaceCulling && oldCull != -1 )
-	{
-		// If true, we had culling enabled previously, so
-		// restore previous settings; otherwise, we ensure it's disabled
-		if ( oldCull == GL_TRUE )
-		{
-			GL_CHECK( glEnable( GL_CULL_FACE ) );
-			GL_CHECK( glCullFace( oldCullMode ) );
-			GL_CHECK( glFrontFace( oldFrontFace ) );
-		}
-		else
-		{
-			GL_CHECK( glDisable( GL_CULL_FACE ) );
-		}
-	}
 }
 
 void BSPRenderer::DrawSkyPass( void )
@@ -769,17 +1330,12 @@ void BSPRenderer::DrawSkyPass( void )
 			SetTex2DMinMagFilters( GL_NEAREST, GL_NEAREST );
 		}
 
-		GLint cull;
-		GL_CHECK( glGetIntegerv( GL_FRONT_FACE, &cull ) );
-		if ( cull != GL_CCW )
-		{
-			GL_CHECK( glFrontFace( GL_CCW ) );
-		}
+		GS_FrontFace( GL_CCW );
 
 		const deformGlobal_t* deformCache = static_cast< const deformGlobal_t* >( voidDeformCache );
 
-		GL_CHECK( glBindBuffer( GL_ARRAY_BUFFER, deformCache->skyVbo ) );
-		GL_CHECK( glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, deformCache->skyIbo ) );
+		GS_BindBuffer( GL_ARRAY_BUFFER, deformCache->skyVbo );
+		GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, deformCache->skyIbo );
 
 		program.LoadDefaultAttribProfiles();
 
@@ -787,13 +1343,8 @@ void BSPRenderer::DrawSkyPass( void )
 	
 		program.DisableDefaultAttribProfiles();
 
-		GL_CHECK( glBindBuffer( GL_ARRAY_BUFFER, apiHandles[ 0 ] ) );
-		GL_CHECK( glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, apiHandles[ 1 ] ) );
-
-		if ( cull != GL_CCW )
-		{
-			GL_CHECK( glFrontFace( GL_CCW ) );
-		}
+		GS_BindBuffer( GL_ARRAY_BUFFER, apiHandles[ 0 ] );
+		GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, apiHandles[ 1 ] );
 
 		// all images are in a texture atlas, so the filtering method
 		// used will undesirably affect other images
@@ -811,22 +1362,20 @@ void BSPRenderer::DrawFaceVerts( const drawPass_t& pass,
 {
 	UNUSED( stage );
 
-	const mapModel_t& m = *( glFaces[ pass.faceIndex ] );
-
-	if ( pass.shader && pass.shader->deform )
-	{
-		DeformVertexes( m, pass.shader );
-	}
-
-	if ( pass.face->type == BSP_FACE_TYPE_POLYGON
-		|| pass.face->type == BSP_FACE_TYPE_MESH )
+	if ( pass.batch )
 	{
-		GU_DrawElements( GL_TRIANGLES, m.iboOffset, m.iboRange );
+		GU_DrawElements( GL_TRIANGLES, pass.batch->iboOffset, pass.batch->iboRange );
 	}
-	else if ( pass.face->type == BSP_FACE_TYPE_PATCH )
+	else if ( pass.face->type == BSP_FACE_TYPE_POLYGON
+		|| pass.face->type == BSP_FACE_TYPE_MESH
+		|| pass.face->type == BSP_FACE_TYPE_PATCH )
 	{
-		const mapPatch_t& p = *( m.ToPatch() );
-		GU_MultiDrawElements( GL_TRIANGLE_STRIP, p.rowIndices, p.trisPerRow );
+		guOffset_t offset;
+		GLsizei count;
+
+		FaceIndexRange( pass.faceIndex, offset, count );
+
+		GU_DrawElements( GL_TRIANGLES, offset, count );
 	}
 }
 
@@ -838,13 +1387,14 @@ void BSPRenderer::BindTexture(
 	const Program& program,
 	const gla_atlas_ptr_t& atlas,
 	uint16_t image,
-	const char* prefix,
+	programUniform_t samplerSlot,
 	int offset
 )
 {
 	gla::atlas_image_info_t imageData = atlas->image_info( image );
 
-	atlas->bind_to_active_slot( imageData.layer, offset );
+	GS_ActiveTexture( GL_TEXTURE0 + offset );
+	GS_BindTexture( atlas->layer_tex_handles[ imageData.layer ] );
 
 	glm::vec4 transform(
 		imageData.coords.x * imageData.inverse_layer_dims.x,
@@ -853,21 +1403,11 @@ void BSPRenderer::BindTexture(
 		atlas->dims_y[ image ]
 	);
 
-	if ( prefix )
-	{
-		std::string strfix( prefix );
-
-		program.LoadInt( strfix + "Sampler", offset );
-		program.LoadVec2( strfix + "ImageScaleRatio",
-			imageData.inverse_layer_dims );
-		program.LoadVec4( strfix + "ImageTransform", transform );
-	}
-	else
-	{
-		program.LoadInt( "sampler0", offset );
-		program.LoadVec2( "imageScaleRatio", imageData.inverse_layer_dims );
-		program.LoadVec4( "imageTransform", transform );
-	}
+	program.LoadInt( samplerSlot, offset );
+	program.LoadVec2( ( programUniform_t )( samplerSlot + UNIFORM_TEXTURE_SCALE_RATIO_OFFSET ),
+		imageData.inverse_layer_dims );
+	program.LoadVec4( ( programUniform_t )( samplerSlot + UNIFORM_TEXTURE_TRANSFORM_OFFSET ),
+		transform );
 }
 
 void BSPRenderer::LoadLightVol(
@@ -897,26 +1437,25 @@ void BSPRenderer::LoadLightVol(
 		glm::vec3 directional( pass.lightvol->directional );
 		directional *= Inv255< float >();
 
-		prog.LoadVec3( "fragDirToLight", dirToLight );
-		prog.LoadVec3( "fragAmbient", ambient );
-		prog.LoadVec3( "fragDirectional", directional );
+		prog.LoadVec3( UNIFORM_FRAG_DIR_TO_LIGHT, dirToLight );
+		prog.LoadVec3( UNIFORM_FRAG_AMBIENT, ambient );
+		prog.LoadVec3( UNIFORM_FRAG_DIRECTIONAL, directional );
 	}
 }
 
 void BSPRenderer::DeformVertexes( const mapModel_t& m,
 	const shaderInfo_t* shader ) const
 {
-	if ( !shader || shader->deformCmd == VERTEXDEFORM_CMD_UNDEFINED ) return;
+	if ( !shader || shader->deformCmd == VERTEXDEFORM_CMD_UNDEFINED
+		|| m.clientVertices.empty() ) return;
 
-	std::vector< bspVertex_t > verts = m.clientVertices;
+	std::vector< bspVertex_t >& verts = deformScratch;
+	verts.resize( m.clientVertices.size() );
 
-	for ( uint32_t i = 0; i < verts.size(); ++i )
-	{
-		glm::vec3 n(
-			verts[ i ].normal * GenDeformScale( verts[ i ].position, shader )
-		);
-		verts[ i ].position += n;
-	}
+	DeformVertexSpan( *shader, deformFrame, &m.clientVertices[ 0 ], &verts[ 0 ],
+		verts.size() );
+
+	GS_BindBuffer( GL_ARRAY_BUFFER, apiHandles[ 0 ] );
 
 	UpdateBufferObject< bspVertex_t >(
 		GL_ARRAY_BUFFER,
@@ -931,69 +1470,238 @@ void BSPRenderer::DeformVertexes( const mapModel_t& m,
 // BSP Traversal
 // -------------------------------
 
-static bool SortOpaqueFacePredicate( const drawFace_t& a, const drawFace_t& b )
+// Writes the depth bits of every face in the pass's lists. Opaque faces
+// are keyed on the nearest point of their bounds, so they're drawn front
+// to back; transparent faces on the farthest, which the descending sort
+// turns into back to front.
+//
+// View depth is linear over a box, so there's no need to transform all 8
+// corners: its range is the depth of the center, plus or minus the
+// extents projected onto the view's depth axis. That's two dot products
+// per face, over packed vec4s, in one pass over each list.
+void BSPRenderer::SetFaceDepths( drawPass_t& pass ) const
 {
-	return a.sort < b.sort;
+	glm::vec4 axis( glm::row( pass.view.transform, 2 ) );
+	glm::vec4 absAxis( glm::abs( glm::vec3( axis ) ), 0.0f );
+
+	const glm::vec4* centers = &clusterFaces.faceCenters[ 0 ];
+	const glm::vec4* extents = &clusterFaces.faceExtents[ 0 ];
+
+	float zNear = pass.view.zNear;
+	float zFar = pass.view.zFar;
+
+	auto LSetDepths = [ & ]( std::vector< drawFace_t >& faces, float side )
+	{
+		for ( drawFace_t& face: faces )
+		{
+			size_t index = face.GetMapFaceIndex();
+
+			// center.w is 1, so this picks up the translation too
+			float centerZ = glm::dot( axis, centers[ index ] );
+			float radiusZ = glm::dot( absAxis, extents[ index ] );
+
+			// view space looks down -Z, so nearer is larger
+			face.SetDepthValue( GU_MapViewDepthToInt( centerZ + side * radiusZ, zNear, zFar ) );
+		}
+	};
+
+	LSetDepths( pass.opaqueFaces, 1.0f );
+	LSetDepths( pass.transparentFaces, -1.0f );
 }
 
-static bool SortTransparentFacePredicate( const drawFace_t& a, const drawFace_t& b )
+static INLINE size_t DrawFaceSortKey( const drawFace_t& face )
 {
-	return a.sort > b.sort;
+	return face.sort;
+}
+
+// Opaque faces are drawn in ascending key order, transparent
+// faces in descending order.
+void BSPRenderer::SortFaceList( std::vector< drawFace_t >& faces, bool solid )
+{
+	RadixSort( faces, sortScratch, DRAWFACE_SORT_KEY_BITS, !solid, DrawFaceSortKey );
+}
+
+// Each visible patch asks for the coarsest LOD whose sub-patches keep
+// every tessellated edge under pixelsPerEdge on screen, going by a
+// sub-patch's size at the nearest point of the patch's bounds. Its
+// group then settles on the finest LOD any of its members asked for.
+void BSPRenderer::SelectPatchLods( const drawPass_t& pass )
+{
+	if ( !patchLods.numGroups )
+	{
+		return;
+	}
+
+	const float pixelScale = pass.view.height / ( 2.0f * glm::tan( pass.view.fovy * 0.5f ) );
+	const glm::vec3 origin( pass.view.origin );
+
+	std::fill( patchLods.groupLods.begin(), patchLods.groupLods.end(), ( uint8_t ) PATCH_MAX_LODS );
+
+	auto LRequest = [ & ]( const std::vector< drawFace_t >& faces )
+	{
+		for ( const drawFace_t& dface: faces )
+		{
+			size_t index = dface.GetMapFaceIndex();
+
+			if ( map.data.faces[ index ].type != BSP_FACE_TYPE_PATCH )
+			{
+				continue;
+			}
+
+			const mapPatch_t& patch = *( glFaces[ index ]->ToPatch() );
+			const patchLod_t& finest = patch.lods[ 0 ];
+
+			float radius = glm::length( glm::vec3( clusterFaces.faceExtents[ index ] ) );
+			float distance = glm::max( glm::length( glm::vec3( clusterFaces.faceCenters[ index ] ) - origin ) - radius,
+				pass.view.zNear );
+
+			float numSubPatches = ( float )( finest.numIndices / ( finest.subdivLevel * finest.subdivLevel * 6 ) );
+			float subPatchPixels = 2.0f * radius / glm::sqrt( numSubPatches ) * pixelScale / distance;
+			float edgesWanted = subPatchPixels / patchLods.pixelsPerEdge;
+
+			uint32_t lod = patch.numLods - 1;
+
+			while ( lod > 0 && ( float ) patch.lods[ lod ].subdivLevel < edgesWanted )
+			{
+				lod--;
+			}
+
+			uint8_t& group = patchLods.groupLods[ patch.lodGroup ];
+			group = glm::min( group, ( uint8_t ) lod );
+		}
+	};
+
+	LRequest( pass.opaqueFaces );
+	LRequest( pass.transparentFaces );
+
+	auto LAssign = [ & ]( const std::vector< drawFace_t >& faces )
+	{
+		for ( const drawFace_t& dface: faces )
+		{
+			size_t index = dface.GetMapFaceIndex();
+
+			if ( map.data.faces[ index ].type != BSP_FACE_TYPE_PATCH )
+			{
+				continue;
+			}
+
+			const mapPatch_t& patch = *( glFaces[ index ]->ToPatch() );
+
+			// A group's LOD is no coarser than any member asked for, so it's
+			// always within each member's own chain
+			patchLods.faceLods[ index ] = patchLods.groupLods[ patch.lodGroup ];
+		}
+	};
+
+	LAssign( pass.opaqueFaces );
+	LAssign( pass.transparentFaces );
 }
 
 void BSPRenderer::RenderPass( const viewParams_t& view )
 {
+	// Anything outside of the renderer may have touched GL state since
+	// the last frame, so nothing the cache holds is trusted at this point
+	GS_Invalidate();
+
+	// Rows of the view rotation are the camera's axes in world space
+	deformFrame.time = GetTimeSeconds();
+	deformFrame.viewRight = glm::vec3( view.transform[ 0 ][ 0 ], view.transform[ 1 ][ 0 ],
+		view.transform[ 2 ][ 0 ] );
+	deformFrame.viewUp = glm::vec3( view.transform[ 0 ][ 1 ], view.transform[ 1 ][ 1 ],
+		view.transform[ 2 ][ 1 ] );
+
 	DrawSkyPass();
 
 	memset( &gCounts, 0, sizeof( gCounts ) );
 
-	drawPass_t pass( map, view );
+	drawPass_t& pass = framePass;
+	pass.Begin( map, view );
 	pass.leaf = map.FindClosestLeaf( pass.view.origin );
 
-	frustum->Update( pass.view, true );
+	bool reuseView = viewCache.Matches( pass.view );
 
-	// We start at index 1 because the 0th index
-	// provides a model which represents the entire map.
-	for ( int32_t i = 1; i < map.data.numModels; ++i )
+	if ( reuseView )
 	{
-		DrawModel( pass, true, map.data.models[ i ] );
+		// The cached lists are swapped back in after drawing
+		pass.opaqueFaces.swap( viewCache.opaqueFaces );
+		pass.transparentFaces.swap( viewCache.transparentFaces );
+	}
+	else
+	{
+		frustum->Update( pass.view, true );
+
+		// We start at index 1 because the 0th index
+		// provides a model which represents the entire map.
+		for ( int32_t i = 1; i < map.data.numModels; ++i )
+		{
+			DrawModel( pass, true, map.data.models[ i ] );
+		}
+
+		CollectVisibleFaces( pass );
+
+		SelectPatchLods( pass );
+
+		SetFaceDepths( pass );
+
+		SortFaceList( pass.opaqueFaces, true );
+		SortFaceList( pass.transparentFaces, false );
+
+		// The batches index into the lists, so they're cached along with them
+		frameBatches.indices.clear();
+		BuildDrawBatches( frameBatches.opaque, pass.opaqueFaces, true );
+		BuildDrawBatches( frameBatches.transparent, pass.transparentFaces, false );
+		UploadDrawBatches();
 	}
 
 	pass.type = PASS_DRAW;
 
 	if ( allowFaceCulling )
 	{
-		GL_CHECK( glEnable( GL_CULL_FACE ) );
-		GL_CHECK( glCullFace( GL_FRONT ) );
-		GL_CHECK( glFrontFace( GL_CCW ) );
+		GS_Enable( GL_CULL_FACE );
+		GS_CullFace( GL_FRONT );
+		GS_FrontFace( GL_CCW );
 	}
 	else
 	{
-		GL_CHECK( glDisable( GL_CULL_FACE ) );
+		GS_Disable( GL_CULL_FACE );
 	}
 
-	TraverseDraw( pass, true );
-	TraverseDraw( pass, false );
-
-	// Sort the faces and draw them.
-
-	std::sort( pass.opaqueFaces.begin(), pass.opaqueFaces.end(), SortOpaqueFacePredicate );
 	DrawFaceList( pass, true );
-
-	std::sort( pass.transparentFaces.begin(), pass.transparentFaces.end(), SortTransparentFacePredicate );
 	DrawFaceList( pass, false );
 
 	if ( allowFaceCulling )
 	{
-		GL_CHECK( glDisable( GL_CULL_FACE ) );
+		GS_Disable( GL_CULL_FACE );
+	}
+
+	// The passes only set what they need up front, so whatever the last
+	// effect stage left behind is still live here. The next frame's clear
+	// happens outside the renderer, and with the depth mask off it would
+	// leave this frame's depth in place.
+	GS_DepthMask( GL_TRUE );
+	GS_DepthFunc( GL_LEQUAL );
+	GS_BlendFunc( GL_ONE, GL_ZERO );
+
+	if ( reuseView )
+	{
+		pass.opaqueFaces.swap( viewCache.opaqueFaces );
+		pass.transparentFaces.swap( viewCache.transparentFaces );
+	}
+	else
+	{
+		viewCache.valid = true;
+		viewCache.transform = pass.view.transform;
+		viewCache.clipTransform = pass.view.clipTransform;
+		viewCache.opaqueFaces.assign( pass.opaqueFaces.begin(), pass.opaqueFaces.end() );
+		viewCache.transparentFaces.assign( pass.transparentFaces.begin(), pass.transparentFaces.end() );
 	}
 }
 
 void BSPRenderer::ProcessFace( drawPass_t& pass, uint32_t index )
 {
-	std::vector< bool >& facesVisitedList = pass.isSolid ? pass.opaqueFacesVisited : pass.transparentFacesVisited;
+	std::vector< uint32_t >& facesVisitedList = pass.isSolid ? pass.opaqueFacesVisited : pass.transparentFacesVisited;
 
-	if ( facesVisitedList[ index ] )
+	if ( facesVisitedList[ index ] == pass.visitStamp )
 	{
 		return;
 	}
@@ -1026,16 +1734,7 @@ void BSPRenderer::ProcessFace( drawPass_t& pass, uint32_t index )
 			dface.SetMapFaceIndex( index );
 			dface.SetShaderListIndex( pass.shader->sortListIndex );
 
-			// TODO: do view-space zDepth evaluation here.
-			
-			// Keep track of max/min view-space z-values for each face;
-			// ensure that closest point on face bounds (out of the 8 corners)
-			// relative to the view frustum is compared against max-z and farthest
-			// relative to the view frustum is compared against min-z. 
-
-			// This is 8 matrix/vector multiplies (using the world->camera transform). Using SIMD and packing
-			// corner vectors into a 4D matrix you can do these ops in two.
-			// Get it working first, though.
+			// Depth is filled in for the whole list at once by SetFaceDepths
 
 			if ( transparent )
 			{
@@ -1049,7 +1748,7 @@ void BSPRenderer::ProcessFace( drawPass_t& pass, uint32_t index )
 	}
 
 end:
-	facesVisitedList[ index ] = true;	
+	facesVisitedList[ index ] = pass.visitStamp;	
 }
 
 void BSPRenderer::DrawModel( drawPass_t& pass, bool frustumCull, bspModel_t& model )
@@ -1070,91 +1769,157 @@ void BSPRenderer::DrawModel( drawPass_t& pass, bool frustumCull, bspModel_t& mod
 	}
 }
 
-void BSPRenderer::DrawNode( drawPass_t& pass, int32_t nodeIndex )
+// Everything in the view cluster's list already passed the PVS test
+// at load time, so all that's left is a frustum test per face.
+void BSPRenderer::CollectVisibleFaces( drawPass_t& pass )
 {
-	if ( nodeIndex < 0 )
+	uint32_t list = clusterFaces.ListIndex( pass.leaf->clusterIndex );
+
+	uint32_t begin = clusterFaces.offsets[ list ];
+	uint32_t end = clusterFaces.offsets[ list + 1 ];
+
+	for ( uint32_t i = begin; i < end; ++i )
 	{
-		pass.viewLeafIndex = -( nodeIndex + 1 );
-		const bspLeaf_t* viewLeaf = &map.data.leaves[ pass.viewLeafIndex ];
+		uint32_t index = clusterFaces.faces[ i ];
 
-		if ( !map.IsClusterVisible( pass.leaf->clusterIndex,
-				viewLeaf->clusterIndex ) )
+		if ( !frustum->IntersectsBox( glFaces[ index ]->bounds ) )
 		{
-			return;
+			continue;
 		}
 
-		AABB leafBounds;
+		const drawFace_t& dface = clusterFaces.faceKeys[ index ];
 
-		leafBounds.maxPoint = glm::vec3(
-			viewLeaf->boxMax.x,
-			viewLeaf->boxMax.y,
-			viewLeaf->boxMax.z
-		);
-
-		leafBounds.minPoint = glm::vec3(
-			viewLeaf->boxMin.x,
-			viewLeaf->boxMin.y,
-			viewLeaf->boxMin.z
-		);
-
-		if ( !frustum->IntersectsBox( leafBounds ) )
+		if ( dface.GetTransparent() )
 		{
-			return;
+			pass.transparentFaces.push_back( dface );
 		}
-
-		for ( int32_t i = 0; i < viewLeaf->numLeafFaces; ++i )
+		else
 		{
-			ProcessFace( 
-				pass, 
-				map.data.leafFaces[ viewLeaf->leafFaceOffset + i ].index 
-			);
+			pass.opaqueFaces.push_back( dface );
 		}
 	}
-	else
+}
+
+// Faces deformed on the CPU have their vertices rewritten per draw, so
+// they can't be folded into a merged run. Everything else, patches
+// included, is drawn as plain triangles.
+static INLINE bool IsBatchableFace( const bspFace_t& face, const shaderInfo_t* shader )
+{
+	return ( face.type == BSP_FACE_TYPE_POLYGON || face.type == BSP_FACE_TYPE_MESH
+			|| face.type == BSP_FACE_TYPE_PATCH )
+		&& !( shader && shader->deform && !DeformUsesGPU( shader ) );
+}
+
+// Patches draw only the indices of the LOD SelectPatchLods picked for them
+void BSPRenderer::FaceIndexRange( size_t faceIndex, guOffset_t& offset, GLsizei& count ) const
+{
+	const mapModel_t& m = *( glFaces[ faceIndex ] );
+
+	offset = ( guOffset_t ) m.iboOffset;
+	count = m.iboRange;
+
+	if ( map.data.faces[ faceIndex ].type == BSP_FACE_TYPE_PATCH )
 	{
-		const bspNode_t* const node = &map.data.nodes[ nodeIndex ];
-		const bspPlane_t* const plane = &map.data.planes[ node->plane ];
+		const patchLod_t& lod = m.ToPatch()->lods[ patchLods.faceLods[ faceIndex ] ];
 
-		float d = glm::dot( pass.view.origin, glm::vec3( plane->normal.x,
-			plane->normal.y, plane->normal.z ) );
+		offset += lod.indexOffset;
+		count = lod.numIndices;
+	}
+}
 
-		// We're in front of the plane if d > plane->distance.
-		// If both of these are true, it makes sense to draw what is in
-		// front of us, as any non-solid object can be handled properly by
-		// depth if it's infront of the partition plane and we're behind it
+void BSPRenderer::BuildDrawBatches( std::vector< drawBatch_t >& batches,
+	const std::vector< drawFace_t >& faces, bool solid )
+{
+	const shaderList_t& sortedShaderList = solid ? map.opaqueShaderList : map.transparentShaderList;
 
-		if ( pass.isSolid == ( d > plane->distance ) )
-		{
-			DrawNode( pass, node->children[ 0 ] );
-			DrawNode( pass, node->children[ 1 ] );
-		}
-		else
+	batches.clear();
+
+	size_t i = 0;
+
+	while ( i < faces.size() )
+	{
+		drawBatch_t batch;
+		batch.first = ( uint32_t ) i;
+		batch.count = 1;
+
+		size_t shaderIndex = faces[ i ].GetShaderListIndex();
+		const bspFace_t& face = map.data.faces[ faces[ i ].GetMapFaceIndex() ];
+
+		if ( !clientIndices.empty() && IsBatchableFace( face, sortedShaderList[ shaderIndex ] ) )
 		{
-			DrawNode( pass, node->children[ 1 ] );
-			DrawNode( pass, node->children[ 0 ] );
+			size_t end = i + 1;
+
+			// The list is sorted by shader first, so equal shaders are already adjacent
+			for ( ; end < faces.size() && faces[ end ].GetShaderListIndex() == shaderIndex; ++end )
+			{
+				const bspFace_t& next = map.data.faces[ faces[ end ].GetMapFaceIndex() ];
+
+				if ( !IsBatchableFace( next, sortedShaderList[ shaderIndex ] )
+					|| next.shader != face.shader
+					|| next.lightmapIndex != face.lightmapIndex )
+				{
+					break;
+				}
+			}
+
+			if ( end - i > 1 )
+			{
+				batch.count = ( uint32_t )( end - i );
+				batch.iboOffset = ( guOffset_t ) frameBatches.indices.size();
+
+				for ( size_t k = i; k < end; ++k )
+				{
+					guOffset_t offset;
+					GLsizei count;
+
+					FaceIndexRange( faces[ k ].GetMapFaceIndex(), offset, count );
+
+					frameBatches.indices.insert( frameBatches.indices.end(),
+						clientIndices.begin() + offset,
+						clientIndices.begin() + offset + count );
+				}
+
+				batch.iboRange = ( GLsizei )( frameBatches.indices.size() - batch.iboOffset );
+			}
 		}
+
+		batches.push_back( batch );
+		i += batch.count;
 	}
 }
 
-
-void BSPRenderer::TraverseDraw( drawPass_t& pass, bool solid )
+// One upload covers every merged run in the frame; the buffer is
+// respecified each time so the driver can orphan the old storage.
+void BSPRenderer::UploadDrawBatches( void )
 {
-	pass.isSolid = solid;
-	DrawNode( pass, 0 );
+	if ( frameBatches.indices.empty() )
+	{
+		return;
+	}
+
+	GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, batchIndexBuffer );
+	GL_CHECK( glBufferData( GL_ELEMENT_ARRAY_BUFFER,
+		sizeof( frameBatches.indices[ 0 ] ) * frameBatches.indices.size(),
+		&frameBatches.indices[ 0 ], GL_STREAM_DRAW ) );
+	GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, apiHandles[ 1 ] );
 }
 
 void BSPRenderer::DrawFaceList( drawPass_t& pass, bool solid )
 {
 	const std::vector< drawFace_t >& faceList = solid ? pass.opaqueFaces : pass.transparentFaces;
+	const std::vector< drawBatch_t >& batches = solid ? frameBatches.opaque : frameBatches.transparent;
 	const shaderList_t& sortedShaderList = solid ? map.opaqueShaderList : map.transparentShaderList;
 
 	pass.isSolid = solid;
 
-	for ( size_t i = 0; i < faceList.size(); ++i )
+	for ( const drawBatch_t& batch: batches )
 	{
+		size_t i = batch.first;
+
 		pass.shader = sortedShaderList[ faceList[ i ].GetShaderListIndex() ];
 		pass.faceIndex = faceList[ i ].GetMapFaceIndex();
 		pass.face = &map.data.faces[ pass.faceIndex ];
+		pass.batch = nullptr;
 
 		if ( pass.isDebugDraw )
 		{
@@ -1169,14 +1934,44 @@ void BSPRenderer::DrawFaceList( drawPass_t& pass, bool solid )
 			pass.drawType = PASS_DRAW_EFFECT;
 		}
 
-		DrawFace( pass );
+		// The debug callback draws per face, so runs are split back up for it
+		if ( batch.count > 1 && pass.drawType != PASS_DRAW_DEBUG )
+		{
+			pass.batch = &batch;
+			gCounts.numDraws++;
+			gCounts.numBatchedFaces += batch.count;
+
+			GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, batchIndexBuffer );
+			DrawFace( pass );
+
+			pass.batch = nullptr;
+		}
+		else
+		{
+			GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, apiHandles[ 1 ] );
+
+			for ( uint32_t k = 0; k < batch.count; ++k )
+			{
+				pass.faceIndex = faceList[ i + k ].GetMapFaceIndex();
+				pass.face = &map.data.faces[ pass.faceIndex ];
+
+				gCounts.numDraws++;
+				DrawFace( pass );
+			}
+		}
 	}
+
+	GS_BindBuffer( GL_ELEMENT_ARRAY_BUFFER, apiHandles[ 1 ] );
 }
 
 void BSPRenderer::DrawFace( drawPass_t& pass )
 {
-	GL_CHECK( glBlendFunc( GL_ONE, GL_ZERO ) );
-	GL_CHECK( glDepthFunc( GL_LEQUAL ) );
+	// Once per face, rather than once per stage
+	if ( pass.drawType == PASS_DRAW_EFFECT
+		&& pass.shader && pass.shader->deform && !DeformUsesGPU( pass.shader ) )
+	{
+		DeformVertexes( *( glFaces[ pass.faceIndex ] ), pass.shader );
+	}
 
 	auto LEffectCallback = [ &pass, this ]( const void* param, const Program& prog,
 		const shaderStage_t* stage )
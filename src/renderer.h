@@ -6,6 +6,7 @@
 #include "frustum.h"
 #include "aabb.h"
 #include "glutil.h"
+#include "deform.h"
 #include "renderer/util.h"
 #include <array>
 #include <functional>
@@ -64,6 +65,9 @@ enum
 	DRAWFACE_SORT_DEPTH_BITS = 24,
 	DRAWFACE_SORT_DEPTH_MASK = MAKE_BASE2_MASK( DRAWFACE_SORT_DEPTH_BITS, DRAWFACE_SORT_DEPTH_SHIFT ),
 
+	// every bit of drawFace_t::sort which is in use
+	DRAWFACE_SORT_KEY_BITS = DRAWFACE_SORT_SHADER_INDEX_SHIFT + DRAWFACE_SORT_SHADER_INDEX_BITS,
+
 	DRAWFACE_METADATA_IS_TRANSPARENT_SHIFT = 31,
 	DRAWFACE_METADATA_MAP_FACE_INDEX_MASK = 0x7FFFFFFF
 
@@ -124,7 +128,7 @@ struct drawPass_t
 	bool isSolid;
 	bool envmap: 1;
 	
-	int faceIndex, viewLeafIndex;
+	int faceIndex;
 
 	passType_t type;
 	passDrawType_t drawType;
@@ -138,7 +142,7 @@ struct drawPass_t
 
 	const shaderInfo_t* shader;
 
-	const viewParams_t& view;
+	viewParams_t view;
 
 	float minFaceViewDepth, maxFaceViewDepth; 						// max < 0, min > 0 due to RHS and Quake's standards
 
@@ -149,11 +153,100 @@ struct drawPass_t
 	std::function< void( drawPass_t& pass ) > debugDrawCallback;	// should follow the same methodology as the callbacks initialized in "DrawFace"
 	Program* debugProgram;											// is nullptr by default, so this is user specified.
 
-	std::vector< bool > opaqueFacesVisited, transparentFacesVisited;
+	// A face has been visited this frame if its entry equals visitStamp
+	uint32_t visitStamp;
+	std::vector< uint32_t > opaqueFacesVisited, transparentFacesVisited;
+
+	// Set while DrawFace is handling a run of merged faces; see drawBatch_t
+	const struct drawBatch_t* batch;
 	
 	std::vector< drawFace_t > transparentFaces, opaqueFaces;
 
-	drawPass_t( const Q3BspMap& map, const viewParams_t& viewData );
+	drawPass_t( void );
+
+	void Begin( const Q3BspMap& map, const viewParams_t& viewData );
+};
+
+// Built once per map from the PVS: for every cluster, the drawable world
+// faces which are potentially visible from it, deduplicated and in
+// drawFace_t sort order. List i spans faces[ offsets[ i ], offsets[ i + 1 ] ).
+// The list at numClusters is used when the view isn't inside any cluster,
+// or the map has no vis data, and holds every drawable world face.
+struct clusterFaceLists_t
+{
+	int32_t numClusters = 0;
+
+	std::vector< uint32_t > offsets;
+	std::vector< uint32_t > faces;
+
+	// one per map face; only meaningful for faces which appear in a list
+	std::vector< drawFace_t > faceKeys;
+
+	// Center and half size of every map face's bounds, packed for
+	// SetFaceDepths. Faces without bounds have zero extents.
+	std::vector< glm::vec4 > faceCenters;
+	std::vector< glm::vec4 > faceExtents;
+
+	uint32_t ListIndex( int32_t cluster ) const
+	{
+		return ( cluster < 0 || cluster >= numClusters ) ? ( uint32_t ) numClusters : ( uint32_t ) cluster;
+	}
+};
+
+// The last frame's culled and sorted face lists, along with the view they
+// were built for. Nothing in the world moves, so for as long as the camera
+// doesn't either, the lists can be drawn again as they are.
+struct viewStateCache_t
+{
+	bool valid = false;
+
+	glm::mat4 transform;
+	glm::mat4 clipTransform;
+
+	std::vector< drawFace_t > opaqueFaces, transparentFaces;
+
+	bool Matches( const viewParams_t& view ) const
+	{
+		return valid && view.transform == transform && view.clipTransform == clipTransform;
+	}
+};
+
+// Per frame LOD choice for every patch face. A patch's LOD is picked from
+// how large one of its sub-patches is on screen, and then every patch in
+// its mapPatch_t::lodGroup is drawn at the finest LOD any visible member
+// asked for, so neighbouring patches never disagree along an edge.
+struct patchLodState_t
+{
+	// Screen space length, in pixels, one tessellated edge should cover
+	float pixelsPerEdge = 12.0f;
+
+	int32_t numGroups = 0;
+
+	std::vector< uint8_t > faceLods;	// one per map face; index into mapPatch_t::lods
+	std::vector< uint8_t > groupLods;	// one per group, rebuilt every frame
+};
+
+// A run of consecutive entries in a sorted face list, starting at first,
+// which share a shader, texture and lightmap and so can be drawn with the
+// same state. Runs of more than one face have their indices copied into
+// drawBatchList_t::indices at [ iboOffset, iboOffset + iboRange ) and go
+// out in a single draw; anything else is drawn face by face as before.
+struct drawBatch_t
+{
+	uint32_t first = 0;
+	uint32_t count = 0;
+
+	guOffset_t iboOffset = 0;
+	GLsizei iboRange = 0;
+};
+
+// Rebuilt whenever the visible face lists are, and uploaded in one go to
+// BSPRenderer::batchIndexBuffer.
+struct drawBatchList_t
+{
+	std::vector< drawBatch_t > opaque, transparent;
+
+	gIndexBuffer_t indices;
 };
 
 struct effect_t;
@@ -184,6 +277,8 @@ namespace gla {
 	struct atlas_t;
 }
 
+struct mapCache_t;
+
 using gla_atlas_ptr_t = std::unique_ptr< gla::atlas_t >;
 using gla_array_t = std::array< gla_atlas_ptr_t, 4 >;
 
@@ -258,6 +353,29 @@ public:
 	// has one->one mapping with face indices
 	modelBuffer_t					glFaces;
 
+	clusterFaceLists_t				clusterFaces;
+
+	viewStateCache_t				viewCache;
+
+	patchLodState_t					patchLods;
+
+	drawBatchList_t					frameBatches;
+
+	// Client copy of the static index buffer, which batches are built from
+	gIndexBuffer_t					clientIndices;
+
+	GLuint							batchIndexBuffer;
+
+	// Reused every frame, so its buffers only grow until they fit the map
+	drawPass_t						framePass;
+
+	// Scratch space for DeformVertexes and SortFaceList; same idea as framePass
+	mutable std::vector< bspVertex_t >	deformScratch;
+
+	deformFrame_t						deformFrame;
+
+	std::vector< drawFace_t >		sortScratch;
+
 	// has one-one mapping with
 	// face indices - is only used when debugging for immediate data
 	std::vector< debugFace_t > 		glDebugFaces;
@@ -268,6 +386,9 @@ public:
 
 	double							frameTime;
 
+	// GL state changes issued and skipped by the state cache last frame
+	gsCounters_t					glStateCounts;
+
 	bool							alwaysWriteDepth;
 
 	bool							allowFaceCulling;
@@ -309,7 +430,7 @@ public:
 							const Program& program,
 							const gla_atlas_ptr_t& atlas,
 							uint16_t image,
-							const char* prefix,
+							programUniform_t samplerSlot,
 							int offset
 						);
 
@@ -339,9 +460,27 @@ public:
 
 	void 				DrawModel( drawPass_t& pass, bool frustumCull, bspModel_t& model );
 
-	void				DrawNode( drawPass_t& pass, int32_t nodeIndex );
+	void				CollectVisibleFaces( drawPass_t& pass );
+
+	void				SetFaceDepths( drawPass_t& pass ) const;
 
-	void				TraverseDraw( drawPass_t& pass, bool solid );
+	void				SortFaceList( std::vector< drawFace_t >& faces, bool solid );
+
+	void				SelectPatchLods( const drawPass_t& pass );
+
+	void				BuildDrawBatches(
+							std::vector< drawBatch_t >& batches,
+							const std::vector< drawFace_t >& faces,
+							bool solid
+						);
+
+	void				UploadDrawBatches( void );
+
+	void				FaceIndexRange(
+							size_t faceIndex,
+							guOffset_t& offset,
+							GLsizei& count
+						) const;
 
 	void				DrawFaceList(
 							drawPass_t& p,
@@ -358,7 +497,27 @@ public:
 
 	void				Load( renderPayload_t& payload );
 
-	void				LoadVertexData( void );
+	void				GenVertexData(
+							std::vector< bspVertex_t >& vertexData,
+							gIndexBuffer_t& indexData
+						);
+
+	void				UploadVertexData(
+							const bspLumpView_t< bspVertex_t >& vertexData,
+							const bspLumpView_t< gIndex_t >& indexData
+						);
+
+	void				UploadVertexData(
+							const std::vector< bspVertex_t >& vertexData,
+							const gIndexBuffer_t& indexData
+						);
+
+	// Only defined when MAP_CACHE_ENABLED is
+	bool				LoadCachedVertexData( const mapCache_t& cache );
+
+	void				LoadClusterFaceLists( void );
+
+	void				LinkPatchLodGroups( void );
 
 	// -------------------------------
 	// Frame
@@ -0,0 +1,15 @@
+#include "gl_state.h"
+
+gsState_t gGLState;
+
+gsCounters_t GS_TakeCounters( void )
+{
+	gsCounters_t c = gGLState.counters;
+	gGLState.counters = gsCounters_t();
+	return c;
+}
+
+void GS_Invalidate( void )
+{
+	gGLState.stale = GS_STALE_ALL;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "glutil.h"
+
+// Client-side shadow of the GL state the renderer changes per draw.
+// Every change goes through one of the GS_* calls below, which only
+// reaches GL if the value differs from what was last set, and anything
+// which needs the current value reads it from here: nothing in the draw
+// path queries the driver.
+//
+// Code which changes state behind the cache's back (texture uploads,
+// the atlas code, debug drawing) has to call GS_Invalidate afterward.
+// RenderPass does so once at the start of each frame regardless, so the
+// worst an untracked change can do is go unnoticed for the rest of it.
+
+enum
+{
+	GS_MAX_TEXTURE_UNITS = 8
+};
+
+enum gsCap_t
+{
+	GS_CAP_BLEND = 0,
+	GS_CAP_DEPTH_TEST,
+	GS_CAP_CULL_FACE,
+	GS_CAP_POLYGON_OFFSET_FILL,
+	GS_CAP_SCISSOR_TEST,
+	GS_NUM_CAPS
+};
+
+// One bit per tracked value, set while the value is stale
+enum
+{
+	GS_STALE_CAPS = 1 << 0,		// one per gsCap_t
+	GS_STALE_BLEND = 1 << GS_NUM_CAPS,
+	GS_STALE_DEPTH_FUNC = GS_STALE_BLEND << 1,
+	GS_STALE_DEPTH_MASK = GS_STALE_BLEND << 2,
+	GS_STALE_CULL_FACE = GS_STALE_BLEND << 3,
+	GS_STALE_FRONT_FACE = GS_STALE_BLEND << 4,
+	GS_STALE_ARRAY_BUFFER = GS_STALE_BLEND << 5,
+	GS_STALE_ELEMENT_BUFFER = GS_STALE_BLEND << 6,
+	GS_STALE_ACTIVE_TEXTURE = GS_STALE_BLEND << 7,
+	GS_STALE_PROGRAM = GS_STALE_BLEND << 8,
+	GS_STALE_TEXTURES = GS_STALE_BLEND << 9,	// one per texture unit
+
+	GS_STALE_ALL = 0xFFFFFFFF
+};
+
+static_assert( GS_NUM_CAPS + 10 + GS_MAX_TEXTURE_UNITS <= 32, "gsState_t::stale is 32 bits" );
+
+struct gsCounters_t
+{
+	uint32_t issued = 0;	// calls which made it to GL
+	uint32_t skipped = 0;	// calls which matched the shadow state
+};
+
+struct gsState_t
+{
+	// A stale value is one GL may no longer agree with, so the next
+	// change to it goes through whether or not it matches.
+	uint32_t stale = GS_STALE_ALL;
+
+	std::array< bool, GS_NUM_CAPS > caps = {{ false, false, false, false, false }};
+
+	GLenum blendSrcRGB = GL_ONE, blendDstRGB = GL_ZERO;
+	GLenum blendSrcAlpha = GL_ONE, blendDstAlpha = GL_ZERO;
+
+	GLenum depthFunc = GL_LESS;
+	GLboolean depthMask = GL_TRUE;
+
+	GLenum cullFace = GL_BACK;
+	GLenum frontFace = GL_CCW;
+
+	GLuint arrayBuffer = 0;
+	GLuint elementBuffer = 0;
+
+	GLenum activeTexture = GL_TEXTURE0;
+	std::array< GLuint, GS_MAX_TEXTURE_UNITS > textures = {{ 0 }};
+
+	GLuint program = 0;
+
+	gsCounters_t counters;
+};
+
+extern gsState_t gGLState;
+
+// Counters since the last call, which resets them
+gsCounters_t GS_TakeCounters( void );
+
+// Marks everything stale. Values read from the cache afterward are
+// whatever was last set through it, or GL's defaults if nothing was.
+void GS_Invalidate( void );
+
+static INLINE bool GS_Skip( uint32_t bit, bool same )
+{
+	if ( same && !( gGLState.stale & bit ) )
+	{
+		gGLState.counters.skipped++;
+		return true;
+	}
+
+	gGLState.stale &= ~bit;
+	gGLState.counters.issued++;
+	return false;
+}
+
+static INLINE gsCap_t GS_CapIndex( GLenum cap )
+{
+	switch ( cap )
+	{
+		case GL_BLEND: return GS_CAP_BLEND;
+		case GL_DEPTH_TEST: return GS_CAP_DEPTH_TEST;
+		case GL_CULL_FACE: return GS_CAP_CULL_FACE;
+		case GL_POLYGON_OFFSET_FILL: return GS_CAP_POLYGON_OFFSET_FILL;
+		case GL_SCISSOR_TEST: return GS_CAP_SCISSOR_TEST;
+		default: return GS_NUM_CAPS;
+	}
+}
+
+static INLINE void GS_SetEnabled( GLenum cap, bool enabled )
+{
+	gsCap_t i = GS_CapIndex( cap );
+
+	if ( i == GS_NUM_CAPS )
+	{
+		gGLState.counters.issued++;
+	}
+	else if ( GS_Skip( GS_STALE_CAPS << i, gGLState.caps[ i ] == enabled ) )
+	{
+		return;
+	}
+	else
+	{
+		gGLState.caps[ i ] = enabled;
+	}
+
+	if ( enabled )
+	{
+		GL_CHECK( glEnable( cap ) );
+	}
+	else
+	{
+		GL_CHECK( glDisable( cap ) );
+	}
+}
+
+static INLINE void GS_Enable( GLenum cap ) { GS_SetEnabled( cap, true ); }
+
+static INLINE void GS_Disable( GLenum cap ) { GS_SetEnabled( cap, false ); }
+
+static INLINE bool GS_IsEnabled( GLenum cap )
+{
+	gsCap_t i = GS_CapIndex( cap );
+
+	return i != GS_NUM_CAPS && gGLState.caps[ i ];
+}
+
+static INLINE void GS_BlendFuncSeparate( GLenum srcRGB, GLenum dstRGB,
+	GLenum srcAlpha, GLenum dstAlpha )
+{
+	if ( GS_Skip( GS_STALE_BLEND, gGLState.blendSrcRGB == srcRGB && gGLState.blendDstRGB == dstRGB
+		&& gGLState.blendSrcAlpha == srcAlpha && gGLState.blendDstAlpha == dstAlpha ) )
+	{
+		return;
+	}
+
+	gGLState.blendSrcRGB = srcRGB;
+	gGLState.blendDstRGB = dstRGB;
+	gGLState.blendSrcAlpha = srcAlpha;
+	gGLState.blendDstAlpha = dstAlpha;
+
+	GL_CHECK( glBlendFuncSeparate( srcRGB, dstRGB, srcAlpha, dstAlpha ) );
+}
+
+static INLINE void GS_BlendFunc( GLenum src, GLenum dst )
+{
+	GS_BlendFuncSeparate( src, dst, src, dst );
+}
+
+static INLINE void GS_DepthFunc( GLenum func )
+{
+	if ( GS_Skip( GS_STALE_DEPTH_FUNC, gGLState.depthFunc == func ) )
+	{
+		return;
+	}
+
+	gGLState.depthFunc = func;
+	GL_CHECK( glDepthFunc( func ) );
+}
+
+static INLINE void GS_DepthMask( GLboolean mask )
+{
+	if ( GS_Skip( GS_STALE_DEPTH_MASK, gGLState.depthMask == mask ) )
+	{
+		return;
+	}
+
+	gGLState.depthMask = mask;
+	GL_CHECK( glDepthMask( mask ) );
+}
+
+static INLINE void GS_CullFace( GLenum mode )
+{
+	if ( GS_Skip( GS_STALE_CULL_FACE, gGLState.cullFace == mode ) )
+	{
+		return;
+	}
+
+	gGLState.cullFace = mode;
+	GL_CHECK( glCullFace( mode ) );
+}
+
+static INLINE void GS_FrontFace( GLenum mode )
+{
+	if ( GS_Skip( GS_STALE_FRONT_FACE, gGLState.frontFace == mode ) )
+	{
+		return;
+	}
+
+	gGLState.frontFace = mode;
+	GL_CHECK( glFrontFace( mode ) );
+}
+
+static INLINE void GS_BindBuffer( GLenum target, GLuint buffer )
+{
+	GLuint* bound = nullptr;
+	uint32_t bit = 0;
+
+	switch ( target )
+	{
+		case GL_ARRAY_BUFFER:
+			bound = &gGLState.arrayBuffer;
+			bit = GS_STALE_ARRAY_BUFFER;
+			break;
+		case GL_ELEMENT_ARRAY_BUFFER:
+			bound = &gGLState.elementBuffer;
+			bit = GS_STALE_ELEMENT_BUFFER;
+			break;
+		default:
+			break;
+	}
+
+	if ( bound )
+	{
+		if ( GS_Skip( bit, *bound == buffer ) )
+		{
+			return;
+		}
+
+		*bound = buffer;
+	}
+	else
+	{
+		gGLState.counters.issued++;
+	}
+
+	GL_CHECK( glBindBuffer( target, buffer ) );
+}
+
+static INLINE void GS_ActiveTexture( GLenum unit )
+{
+	if ( GS_Skip( GS_STALE_ACTIVE_TEXTURE, gGLState.activeTexture == unit ) )
+	{
+		return;
+	}
+
+	gGLState.activeTexture = unit;
+	GL_CHECK( glActiveTexture( unit ) );
+}
+
+// 2D textures only; the renderer doesn't bind anything else.
+static INLINE void GS_BindTexture( GLuint texture )
+{
+	uint32_t unit = gGLState.activeTexture - GL_TEXTURE0;
+
+	if ( unit < GS_MAX_TEXTURE_UNITS )
+	{
+		if ( GS_Skip( GS_STALE_TEXTURES << unit, gGLState.textures[ unit ] == texture ) )
+		{
+			return;
+		}
+
+		gGLState.textures[ unit ] = texture;
+	}
+	else
+	{
+		gGLState.counters.issued++;
+	}
+
+	GL_CHECK( glBindTexture( GL_TEXTURE_2D, texture ) );
+}
+
+static INLINE void GS_UseProgram( GLuint program )
+{
+	if ( GS_Skip( GS_STALE_PROGRAM, gGLState.program == program ) )
+	{
+		return;
+	}
+
+	gGLState.program = program;
+	GL_CHECK( glUseProgram( program ) );
+}
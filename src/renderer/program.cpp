@@ -1,86 +1,67 @@
 #include "program.h"
-#include "bsp_data.h"
 #include "glutil.h"
+#include "lib/hash.h"
 #include <memory>
+#include <unordered_map>
 
 // Storage for dynamic programs
 
 namespace {
 	std::vector< std::unique_ptr< Program > > gProgramStorage;
 
-	INLINE gProgramHandle_t AddProgram( Program* p )
-	{
-		gProgramHandle_t h = GFindProgramByData( p->attribs,
-			p->uniforms, p->stage );
+	std::unordered_map< uint64_t, uint32_t > gProgramsBySource;
 
-		if ( !G_HNULL( h ) )
-		{
-			return h;
-		}
-			
-		h.id = ( uint32_t ) gProgramStorage.size();
+	gProgramStats_t gProgramStats;
+}
 
-		gProgramStorage.push_back( std::unique_ptr< Program >( p ) );
+uint64_t GHashProgramSource( const std::string& vertexSource,
+	const std::string& fragmentSource,
+	const std::vector< std::string >& attribs )
+{
+	uint64_t hash = HASH_FNV1A_64_SEED;
 
-		return h;
-	}
+	hash = Hash_FNV1a64String( vertexSource, hash );
+	hash = Hash_FNV1a64String( fragmentSource, hash );
 
-	bool CompareMaps( const programDataMap_t& p, const programDataMap_t& q )
+	// Attributes are bound to locations in this order
+	for ( const std::string& attrib: attribs )
 	{
-		if ( p.size() != q.size() )
-			return false;
-
-		for ( const auto& pIterator: p )
-		{
-			bool found = false;
-			for ( const auto& qIterator: q )
-			{
-				if ( pIterator.first == qIterator.first )
-				{
-					found = true;
-					break;
-				}
-			}
-
-			// If this isn't true, we're definitely wasting our time
-			// Since we can only check pIterator->first once
-			if ( !found )
-			{
-				return false;
-			}
-		}
-
-		return true;
+		hash = Hash_FNV1a64String( attrib, hash );
 	}
+
+	return hash;
 }
 
-gProgramHandle_t GFindProgramByData( const programDataMap_t& attribs,
-									 const programDataMap_t& uniforms,
-									 const shaderStage_t* stage )
+gProgramHandle_t GFindProgramBySource( uint64_t sourceHash )
 {
-	for ( uint32_t i = 0; i < gProgramStorage.size(); ++i )
+	gProgramStats.requested++;
+
+	auto it = gProgramsBySource.find( sourceHash );
+
+	if ( it == gProgramsBySource.end() )
 	{
-		const std::unique_ptr< Program >& q = gProgramStorage[ i ];
-
-		if ( CompareMaps( q->attribs, attribs )
-		  && CompareMaps( q->uniforms, uniforms )
-		  && EquivalentProgramTypes( stage, q->stage ) )
-		{
-			return { i };
-		}
+		return { G_UNSPECIFIED };
 	}
 
-	return { G_UNSPECIFIED };
+	return { it->second };
 }
 
-gProgramHandle_t GStoreProgram( Program* p )
+gProgramHandle_t GStoreProgram( Program* p, uint64_t sourceHash )
 {
 	if ( !p )
 	{
 		return { G_UNSPECIFIED };
 	}
 
-	return AddProgram( p );
+	gProgramHandle_t h;
+	h.id = ( uint32_t ) gProgramStorage.size();
+
+	gProgramStorage.push_back( std::unique_ptr< Program >( p ) );
+	gProgramsBySource.insert( std::make_pair( sourceHash, h.id ) );
+
+	gProgramStats.unique++;
+
+	return h;
 }
 
 Program* GQueryProgram( gProgramHandle_t handle )
@@ -97,3 +78,8 @@ size_t GNumPrograms( void )
 {
 	return gProgramStorage.size();
 }
+
+gProgramStats_t GProgramStats( void )
+{
+	return gProgramStats;
+}
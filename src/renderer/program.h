@@ -8,15 +8,31 @@ struct gProgramHandle_t
 	uint32_t id;
 };
 
-struct shaderStage_t;
+class Program;
 
-gProgramHandle_t GFindProgramByData( const programDataMap_t& attribs,
-	const programDataMap_t& uniforms, const shaderStage_t* stage );
+// Generated programs are keyed by a hash of everything they're built
+// from, so stages which generate identical GLSL share one program
+// instead of compiling and linking their own copy.
+uint64_t GHashProgramSource( const std::string& vertexSource,
+	const std::string& fragmentSource,
+	const std::vector< std::string >& attribs );
 
-class Program;
+// The program stored under sourceHash, if there is one. Every call
+// counts as a request in GProgramStats, whether or not it's found.
+gProgramHandle_t GFindProgramBySource( uint64_t sourceHash );
 
-gProgramHandle_t GStoreProgram( Program* p );
+// Takes ownership of p. If sourceHash is already taken (only possible
+// with G_DUPLICATE_PROGRAMS), p is stored anyway but not findable.
+gProgramHandle_t GStoreProgram( Program* p, uint64_t sourceHash );
 
 Program* GQueryProgram( gProgramHandle_t handle );
 
 size_t GNumPrograms( void );
+
+struct gProgramStats_t
+{
+	uint32_t requested = 0;	// GFindProgramBySource calls
+	uint32_t unique = 0;	// programs actually built
+};
+
+gProgramStats_t GProgramStats( void );
@@ -0,0 +1,238 @@
+#include "program_cache.h"
+
+#if defined( PROGRAM_CACHE_ENABLED )
+
+#include "shader_gen.h"
+#include "glutil.h"
+#include "lib/hash.h"
+
+#include <sys/stat.h>
+#include <cstdio>
+
+#define PROGRAM_CACHE_MAGIC "GLPB"
+
+enum
+{
+	PROGRAM_CACHE_VERSION = 1
+};
+
+// [programCacheHeader_t][uint8_t; length]
+struct programCacheHeader_t
+{
+	char		magic[ 4 ];
+	uint32_t	version;
+	uint64_t	driverKey;
+	uint64_t	sourceHash;
+	uint32_t	format;		// GLenum from glGetProgramBinary
+	uint32_t	length;
+};
+
+namespace {
+	struct programCacheState_t
+	{
+		bool initialized = false;
+		bool supported = false;
+
+		uint64_t driverKey = 0;
+
+		programCacheStats_t stats;
+	};
+
+	programCacheState_t gProgramCache;
+
+	INLINE uint64_t HashGLString( GLenum name, uint64_t hash )
+	{
+		const char* s;
+		GL_CHECK( s = ( const char* ) glGetString( name ) );
+
+		return Hash_FNV1a64String( s ? std::string( s ) : std::string(), hash );
+	}
+
+	// Deferred to first use, since it needs a current context
+	bool Init( void )
+	{
+		if ( gProgramCache.initialized )
+		{
+			return gProgramCache.supported;
+		}
+
+		gProgramCache.initialized = true;
+
+		// Core 3.3 only has this through the extension
+#if defined( GLEW_ARB_get_program_binary )
+		if ( !GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1 )
+		{
+			MLOG_INFO( "Program binaries aren't supported; the program cache is disabled" );
+			return false;
+		}
+#endif
+
+		GLint numFormats = 0;
+		GL_CHECK( glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats ) );
+
+		if ( numFormats <= 0 )
+		{
+			MLOG_INFO( "The driver has no program binary formats; the program cache is disabled" );
+			return false;
+		}
+
+		uint64_t key = HASH_FNV1A_64_SEED;
+
+		key = Hash_FNV1a64Value( ( uint32_t ) PROGRAM_CACHE_VERSION, key );
+		key = HashGLString( GL_VENDOR, key );
+		key = HashGLString( GL_RENDERER, key );
+		key = HashGLString( GL_VERSION, key );
+
+		// Prepended to every generated source, but not part of the source hash
+		key = Hash_FNV1a64String( GGetGLSLHeader(), key );
+
+		gProgramCache.driverKey = key;
+		gProgramCache.supported = true;
+
+		mkdir( PROGRAM_CACHE_DIR, 0755 );
+
+		return true;
+	}
+
+	std::string GetPath( uint64_t sourceHash )
+	{
+		char name[ 32 ];
+		snprintf( name, sizeof( name ), "%016llx", ( unsigned long long ) sourceHash );
+
+		return std::string( PROGRAM_CACHE_DIR "/" ) + name + PROGRAM_CACHE_EXT;
+	}
+
+	bool ReadBinary( uint64_t sourceHash, programCacheHeader_t& header,
+		std::vector< uint8_t >& binary )
+	{
+		FILE* f = fopen( GetPath( sourceHash ).c_str(), "rb" );
+
+		if ( !f )
+		{
+			return false;
+		}
+
+		bool good = fread( &header, sizeof( header ), 1, f ) == 1
+			&& memcmp( header.magic, PROGRAM_CACHE_MAGIC, sizeof( header.magic ) ) == 0
+			&& header.version == PROGRAM_CACHE_VERSION
+			&& header.driverKey == gProgramCache.driverKey
+			&& header.sourceHash == sourceHash
+			&& header.length > 0;
+
+		if ( good )
+		{
+			binary.resize( header.length );
+			good = fread( &binary[ 0 ], 1, binary.size(), f ) == binary.size();
+		}
+
+		fclose( f );
+
+		return good;
+	}
+}
+
+bool ProgramCache_Available( void )
+{
+	return Init();
+}
+
+GLuint ProgramCache_Load( uint64_t sourceHash )
+{
+	if ( !Init() )
+	{
+		return 0;
+	}
+
+	programCacheHeader_t header;
+	std::vector< uint8_t > binary;
+
+	if ( !ReadBinary( sourceHash, header, binary ) )
+	{
+		gProgramCache.stats.misses++;
+		return 0;
+	}
+
+	GLuint program;
+	GL_CHECK( program = glCreateProgram() );
+
+	// A driver update which keeps the same version string can still
+	// reject the binary, which shows up as a failed link
+	GL_CHECK( glProgramBinary( program, ( GLenum ) header.format, &binary[ 0 ],
+		( GLsizei ) binary.size() ) );
+
+	GLint linked = GL_FALSE;
+	GL_CHECK( glGetProgramiv( program, GL_LINK_STATUS, &linked ) );
+
+	if ( !linked )
+	{
+		GL_CHECK( glDeleteProgram( program ) );
+		gProgramCache.stats.misses++;
+		return 0;
+	}
+
+	gProgramCache.stats.hits++;
+
+	return program;
+}
+
+void ProgramCache_Store( uint64_t sourceHash, GLuint program )
+{
+	if ( !Init() )
+	{
+		return;
+	}
+
+	GLint length = 0;
+	GL_CHECK( glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length ) );
+
+	if ( length <= 0 )
+	{
+		return;
+	}
+
+	std::vector< uint8_t > binary( ( size_t ) length );
+	GLenum format = 0;
+
+	GL_CHECK( glGetProgramBinary( program, length, &length, &format, &binary[ 0 ] ) );
+
+	programCacheHeader_t header;
+	memcpy( header.magic, PROGRAM_CACHE_MAGIC, sizeof( header.magic ) );
+	header.version = PROGRAM_CACHE_VERSION;
+	header.driverKey = gProgramCache.driverKey;
+	header.sourceHash = sourceHash;
+	header.format = ( uint32_t ) format;
+	header.length = ( uint32_t ) length;
+
+	// Write to the side and rename, same as the map cache
+	std::string path( GetPath( sourceHash ) );
+	std::string tmpPath( path + ".tmp" );
+
+	FILE* f = fopen( tmpPath.c_str(), "wb" );
+
+	if ( !f )
+	{
+		MLOG_ERROR( "Could not open \'%s\' for writing", tmpPath.c_str() );
+		return;
+	}
+
+	bool written = fwrite( &header, sizeof( header ), 1, f ) == 1
+		&& fwrite( &binary[ 0 ], 1, header.length, f ) == header.length;
+
+	written = ( fclose( f ) == 0 ) && written;
+
+	if ( !written || rename( tmpPath.c_str(), path.c_str() ) != 0 )
+	{
+		MLOG_ERROR( "Could not write \'%s\'", path.c_str() );
+		remove( tmpPath.c_str() );
+		return;
+	}
+
+	gProgramCache.stats.stores++;
+}
+
+programCacheStats_t ProgramCache_Stats( void )
+{
+	return gProgramCache.stats;
+}
+
+#endif // PROGRAM_CACHE_ENABLED
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.h"
+#include "renderer_local.h"
+
+// Linked program binaries from glGetProgramBinary, kept on disk so later
+// runs can skip compiling and linking generated stage programs. Each
+// file is keyed by the program's source hash (see GHashProgramSource)
+// and stamped with the driver it came from: a binary from a different
+// vendor, renderer, driver version or GLSL header is a miss, and the
+// program is compiled from source and stored again.
+//
+// Needs a desktop core context, for glProgramBinary, and a file system
+// which persists between runs.
+#if defined( G_USE_GL_CORE ) && defined( __linux__ )
+#	define PROGRAM_CACHE_ENABLED
+#endif
+
+#if defined( PROGRAM_CACHE_ENABLED )
+
+#define PROGRAM_CACHE_DIR ASSET_Q3_ROOT "/glcache"
+#define PROGRAM_CACHE_EXT ".glpb"
+
+struct programCacheStats_t
+{
+	uint32_t hits = 0;
+	uint32_t misses = 0;	// includes driver mismatches and rejected binaries
+	uint32_t stores = 0;
+};
+
+// False if the context can't save or load program binaries,
+// in which case everything below does nothing.
+bool ProgramCache_Available( void );
+
+// Returns a linked program restored from the cache, or 0 if there
+// isn't a usable binary for sourceHash.
+GLuint ProgramCache_Load( uint64_t sourceHash );
+
+// Writes program's binary out under sourceHash; program must be linked.
+void ProgramCache_Store( uint64_t sourceHash, GLuint program );
+
+programCacheStats_t ProgramCache_Stats( void );
+
+#endif // PROGRAM_CACHE_ENABLED
@@ -1,5 +1,7 @@
 #include "shader_gen.h"
 #include "effect_shader.h"
+#include "deform.h"
+#include "program_cache.h"
 
 //--------------------------------------------------
 // DEBUG
@@ -33,9 +35,9 @@ struct meta_t
 		{
 			fprintf( stdout,
 					 "---------------------------\n\n"
-					 "PROGRAM COUNT: %llu"
+					 "PROGRAM COUNT: %llu (%u requested)"
 					 "\n\n-----------------------------",
-					 ( unsigned long long ) GNumPrograms() );
+					 ( unsigned long long ) GNumPrograms(), GProgramStats().requested );
 		}
 	}
 };
@@ -222,9 +224,43 @@ static INLINE std::string JoinLines( std::vector< std::string >& lines )
 	return shaderSrc.str();
 }
 
-static std::string GenVertexShader( shaderStage_t& stage,
+// deformVertexes wave, evaluated per vertex so the map's vertex buffer
+// never has to be rewritten. The waveforms are the closed forms of the
+// ones in gDeformCache's tables; deformParams.y selects one, in
+// vertexDeformFunc_t order starting from VERTEXDEFORM_FUNC_TRIANGLE.
+static std::string DeclDeformWave( void )
+{
+	return R"(
+uniform vec4 deformWave; // base, amplitude, phase, frequency
+uniform vec4 deformParams; // spread, waveform, time
+
+float deformWaveform( in float func, in float x ) {
+	float f = fract( x );
+
+	if ( func < 0.5 ) {
+		return f < 0.25 ? 4.0 * f : ( f < 0.75 ? 2.0 - 4.0 * f : 4.0 * f - 4.0 );
+	} else if ( func < 1.5 ) {
+		return sin( 6.28318530718 * f );
+	} else if ( func < 2.5 ) {
+		return f < 0.5 ? 1.0 : -1.0;
+	} else if ( func < 3.5 ) {
+		return f;
+	}
+
+	return 1.0 - f;
+}
+
+vec3 applyDeform( in vec3 p, in vec3 n ) {
+	float x = deformWave.z + ( p.x + p.y + p.z ) * deformParams.x + deformParams.z * deformWave.w;
+	return p + n * ( deformWave.x + deformWaveform( deformParams.y, x ) * deformWave.y );
+})";
+}
+
+static std::string GenVertexShader( const shaderInfo_t& shader,
+									shaderStage_t& stage,
 									const std::string& texCoordName,
-									std::vector< std::string >& attribs )
+									std::vector< std::string >& attribs,
+									std::vector< std::string >& uniforms )
 {
 
 	size_t vertTransferOffset = 3;
@@ -244,19 +280,37 @@ static std::string GenVertexShader( shaderStage_t& stage,
 		"void main(void) {",
 	};
 
-	if ( stage.tcgen == TCGEN_ENVIRONMENT )
+	bool deform = DeformUsesGPU( &shader );
+
+	if ( deform )
+	{
+		// Just ahead of main()
+		vertexSrc.insert( vertexSrc.end() - 1, DeclDeformWave() );
+		uniforms.push_back( "deformWave" );
+		uniforms.push_back( "deformParams" );
+	}
+
+	if ( stage.tcgen == TCGEN_ENVIRONMENT || deform )
 	{
 		vertexSrc.insert( vertexSrc.begin() + vertAttrOffset++,
 			DeclAttributeVar( "normal", "vec3", attribLocCounter++ ) );
 		attribs.push_back( "normal" );
 	}
 
+	std::string positionName( "position" );
+
+	if ( deform )
+	{
+		vertexSrc.push_back( "\tvec3 deformedPosition = applyDeform( position, normal );" );
+		positionName = "deformedPosition";
+	}
+
 	vertexSrc.push_back(
-		"\tgl_Position = viewToClip * modelToView * vec4( position, 1.0 );" );
+		"\tgl_Position = viewToClip * modelToView * vec4( " + positionName + ", 1.0 );" );
 
 	if ( stage.tcgen == TCGEN_ENVIRONMENT )
 	{
-		AddCalcEnvMap( vertexSrc, "position", "normal",
+		AddCalcEnvMap( vertexSrc, positionName, "normal",
 			"vec3( -modelToView[ 3 ] )" );
 		vertexSrc.push_back( "\tfrag_Tex = st;" );
 	}
@@ -565,25 +619,48 @@ void GMakeProgramsFromEffectShader( shaderInfo_t& shader )
 			attribs.push_back( texCoordName );
 		}
 
-		const std::string& vertexString = GenVertexShader( stage, texCoordName, attribs );
+		const std::string& vertexString = GenVertexShader( shader, stage, texCoordName,
+			attribs, uniforms );
 		const std::string& fragmentString = GenFragmentShader( stage, uniforms );
 
-		Program* p = new Program( vertexString, fragmentString, uniforms, attribs );
+		// Only compile and link if nothing else has generated the same program.
+		// The uniform list follows from the source, so it isn't part of the key.
+		uint64_t sourceHash = GHashProgramSource( vertexString, fragmentString, attribs );
+
+		stage.program = GFindProgramBySource( sourceHash );
 
 		// On the directive: this is good for testing and
 		// doing performance comparisons
 #ifndef G_DUPLICATE_PROGRAMS
-		stage.program = GFindProgramByData( p->attribs, p->uniforms, &stage );
 		if ( G_HNULL( stage.program ) )
 #endif
 		{
+			Program* p = nullptr;
+
+#if defined( PROGRAM_CACHE_ENABLED )
+			GLuint cached = ProgramCache_Load( sourceHash );
+
+			if ( cached )
+			{
+				p = new Program( cached, uniforms, attribs );
+			}
+			else
+#endif
+			{
+				p = new Program( vertexString, fragmentString, uniforms, attribs );
+
+#if defined( PROGRAM_CACHE_ENABLED )
+				ProgramCache_Store( sourceHash, p->GetHandle() );
+#endif
+			}
+
 #ifdef DEBUG
 			p->vertexSource = vertexString;
 			p->fragmentSource = fragmentString;
 #endif
 
 			p->stage = &stage;
-			stage.program = GStoreProgram( p );
+			stage.program = GStoreProgram( p, sourceHash );
 /*
 			{
 				std::string logVertTitle( std::string( "vertex, " ) + std::string( &stage.texturePath[ 0 ] ) );
@@ -596,12 +673,5 @@ void GMakeProgramsFromEffectShader( shaderInfo_t& shader )
 			}
 			*/
 		}
-
-#ifndef G_DUPLICATE_PROGRAMS
-		else
-		{
-			delete p;
-		}
-#endif
 	}
 }
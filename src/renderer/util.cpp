@@ -329,10 +329,9 @@ size_t GU_MapViewDepthToInt( float viewZDepth, float zMin, float zMax )
 	// view space looks down -Z
 	float zDepth = -viewZDepth; 
 
-	if ( zDepth < zMin || zDepth > zMax )
-	{
-		return G_MAPPED_DEPTH_CLIPPED;
-	}
+	// Anything outside of the range still has to sort sensibly
+	// relative to everything else, so clamp rather than reject
+	zDepth = glm::clamp( zDepth, zMin, zMax );
 
 	// update if we need to
 	if ( zMin != gDiffZCache.zMin || zMax != gDiffZCache.zMax )
@@ -342,7 +341,7 @@ size_t GU_MapViewDepthToInt( float viewZDepth, float zMin, float zMax )
 		gDiffZCache.iDiffZ = 1.0f / zDiff;
 	}
 
-	float normalized = zMax * gDiffZCache.iDiffZ - zMax * zMin * gDiffZCache.iDiffZ / zDiff;
+	float normalized = ( zDepth - zMin ) * gDiffZCache.iDiffZ;
 
 	size_t ret = ( size_t )( normalized * ( float ) DRAWFACE_SORT_DEPTH_MASK );
 	return ret;
@@ -1,10 +1,10 @@
 #pragma once
 
 #include "glutil.h"
+#include "gl_state.h"
+#include "extern/gl_atlas.h"
 
 using guOffset_t = intptr_t;
-using guBufferOffsetList_t = std::vector< guOffset_t >;
-using guBufferRangeList_t = std::vector< GLsizei >;
 
 static INLINE void GU_DrawElements(
 	GLenum mode,
@@ -20,18 +20,6 @@ static INLINE void GU_DrawElements(
 			( const GLvoid* )( buffOffset * G_INDEX_BYTE_STRIDE ) ) );
 }
 
-static INLINE void GU_MultiDrawElements(
-	GLenum mode,
-	const guBufferOffsetList_t& indexBuffers,
-	const guBufferRangeList_t& indexBufferSizes
-)
-{
-	for ( uint32_t i = 0; i < indexBuffers.size(); ++i )
-	{
-		GU_DrawElements( mode, indexBuffers[ i ], indexBufferSizes[ i ] );
-	}
-}
-
 class Q3BspMap;
 
 void GU_LoadShaderTextures( Q3BspMap& map );
@@ -40,25 +28,69 @@ void GU_LoadDebugTextures( Q3BspMap& map );
 
 size_t GU_MapViewDepthToInt( float viewZDepth, float zmin, float zmax );
 
+// Lightmaps go through gla::brighten_rgb, then get expanded to RGBA and
+// premultiplied as an opaque image. Every step only depends on the
+// source bytes, so one pass over tables reproduces the whole chain
+// exactly: the shift, a scale per possible max channel in place of
+// the divide, and the post_process_rgba premultiply row for alpha 255.
+struct guLightmapIngest_t
+{
+	std::array< float, ( 255 << 2 ) + 1 > brightenScale;
+
+	const uint8_t* premul;
+
+	guLightmapIngest_t( void )
+		: premul( &gla::gamma_tables().premul[ 255 << 8 ] )
+	{
+		for ( uint32_t m = 0; m < brightenScale.size(); ++m )
+		{
+			// 1 where brighten_rgb leaves the pixel alone
+			brightenScale[ m ] = m > 255 ? 255.0f / ( float ) m : 1.0f;
+		}
+	}
+};
+
+// dest receives BSP_LIGHTMAP_WIDTH * BSP_LIGHTMAP_HEIGHT RGBA pixels
+static INLINE void GU_IngestLightmap( const guLightmapIngest_t& tables,
+	const bspLightmap_t& lightmap, uint8_t* dest )
+{
+	const uint8_t* src = &lightmap.map[ 0 ][ 0 ][ 0 ];
+
+	for ( uint32_t i = 0; i < BSP_LIGHTMAP_WIDTH * BSP_LIGHTMAP_HEIGHT; ++i )
+	{
+		uint32_t r = ( ( uint32_t ) src[ 0 ] ) << 2;
+		uint32_t g = ( ( uint32_t ) src[ 1 ] ) << 2;
+		uint32_t b = ( ( uint32_t ) src[ 2 ] ) << 2;
+
+		float scale = tables.brightenScale[ std::max( r, std::max( g, b ) ) ];
+
+		dest[ 0 ] = tables.premul[ ( uint32_t )( ( float ) r * scale ) ];
+		dest[ 1 ] = tables.premul[ ( uint32_t )( ( float ) g * scale ) ];
+		dest[ 2 ] = tables.premul[ ( uint32_t )( ( float ) b * scale ) ];
+		dest[ 3 ] = 255;
+
+		src += 3;
+		dest += 4;
+	}
+}
+
 using guImmPosList_t = std::vector< glm::vec3 >;
 
 struct pushBlend_t
 {
-	GLint srcAlpha, srcRGB, destAlpha, destRGB;
+	GLenum srcAlpha, srcRGB, destAlpha, destRGB;
 
 	pushBlend_t( GLenum newSrc, GLenum newDst )
+		: srcAlpha( gGLState.blendSrcAlpha ),
+		  srcRGB( gGLState.blendSrcRGB ),
+		  destAlpha( gGLState.blendDstAlpha ),
+		  destRGB( gGLState.blendDstRGB )
 	{
-		GL_CHECK( glGetIntegerv( GL_BLEND_SRC_ALPHA, &srcAlpha ) );
-		GL_CHECK( glGetIntegerv( GL_BLEND_SRC_RGB, &srcRGB ) );
-
-		GL_CHECK( glGetIntegerv( GL_BLEND_DST_ALPHA, &destAlpha ) );
-		GL_CHECK( glGetIntegerv( GL_BLEND_DST_RGB, &destRGB ) );
-
-		GL_CHECK( glBlendFunc( newSrc, newDst ) );
+		GS_BlendFunc( newSrc, newDst );
 	}
 
 	~pushBlend_t( void )
 	{
-		GL_CHECK( glBlendFuncSeparate( srcRGB, destRGB, srcAlpha, destAlpha ) );
+		GS_BlendFuncSeparate( srcRGB, destRGB, srcAlpha, destAlpha );
 	}
 };
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "io.h"
 #include "glutil.h"
 #include "renderer/shared.h"
+#include "renderer/program_cache.h"
 
 GLuint LinkProgram( GLuint shaders[], int len, const std::vector< std::string >& bindAttribs )
 {
@@ -18,6 +19,13 @@ GLuint LinkProgram( GLuint shaders[], int len, const std::vector< std::string >&
 		GL_CHECK( glBindAttribLocation( program, i, bindAttribs[ i ].c_str() ) );
 #endif
 
+#if defined( PROGRAM_CACHE_ENABLED )
+	if ( ProgramCache_Available() )
+	{
+		GL_CHECK( glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE ) );
+	}
+#endif
+
 	GL_CHECK( glLinkProgram( program ) );
 
 	GLint linkSuccess;
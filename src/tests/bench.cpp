@@ -0,0 +1,529 @@
+#if defined( BSPVIEW_BENCHMARKS )
+
+#include "bench.h"
+#include "renderer.h"
+#include "lib/radix_sort.h"
+#include "extern/gl_atlas.h"
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+//--------------------------------------------------------------
+// timing
+//--------------------------------------------------------------
+
+static double Bench_NowMs( void )
+{
+	using clock_t = std::chrono::high_resolution_clock;
+
+	return std::chrono::duration< double, std::milli >(
+		clock_t::now().time_since_epoch() ).count();
+}
+
+// Average time of fn in milliseconds. prepare runs before every
+// iteration and isn't timed.
+template < typename Tprep, typename Tfn >
+static double Bench_Time( uint32_t iterations, Tprep prepare, Tfn fn )
+{
+	double total = 0.0;
+
+	for ( uint32_t i = 0; i < iterations; ++i )
+	{
+		prepare();
+
+		double start = Bench_NowMs();
+		fn();
+		total += Bench_NowMs() - start;
+	}
+
+	return total / ( double ) iterations;
+}
+
+//--------------------------------------------------------------
+// drawFace_t sort
+//--------------------------------------------------------------
+
+void Bench_DrawFaceSort( void )
+{
+	const size_t faceCounts[] = { 1000, 10000, 100000 };
+
+	std::mt19937 rng( 1337 );
+
+	for ( size_t count: faceCounts )
+	{
+		// Keys are spread like a real frame's: a few hundred shaders
+		// and depth values all over the 24 bit range
+		std::vector< drawFace_t > source( count );
+
+		for ( size_t i = 0; i < count; ++i )
+		{
+			source[ i ].SetMapFaceIndex( i );
+			source[ i ].SetShaderListIndex( rng() & 0xFF );
+			source[ i ].SetDepthValue( rng() & 0xFFFFFF );
+		}
+
+		std::vector< drawFace_t > work, scratch, expected;
+
+		uint32_t iterations = ( uint32_t ) std::max( ( size_t ) 10, 2000000 / count );
+
+		for ( bool descending: { false, true } )
+		{
+			auto LPrepare = [ & ]( void ) { work.assign( source.begin(), source.end() ); };
+
+			double stdMs = Bench_Time( iterations, LPrepare, [ & ]( void )
+			{
+				if ( descending )
+				{
+					std::sort( work.begin(), work.end(), []( const drawFace_t& a, const drawFace_t& b )
+						{ return a.sort > b.sort; } );
+				}
+				else
+				{
+					std::sort( work.begin(), work.end(), []( const drawFace_t& a, const drawFace_t& b )
+						{ return a.sort < b.sort; } );
+				}
+			} );
+
+			expected.assign( work.begin(), work.end() );
+
+			double radixMs = Bench_Time( iterations, LPrepare, [ & ]( void )
+			{
+				RadixSort( work, scratch, DRAWFACE_SORT_KEY_BITS, descending,
+					[]( const drawFace_t& f ) { return f.sort; } );
+			} );
+
+			bool match = true;
+
+			for ( size_t i = 0; i < count && match; ++i )
+			{
+				match = work[ i ].sort == expected[ i ].sort;
+			}
+
+			printf( "drawFace_t sort | " F_SIZE_T " faces, %s | std::sort: %.4f ms | radix: %.4f ms | %.2fx%s\n",
+				count,
+				descending ? "descending" : "ascending",
+				stdMs,
+				radixMs,
+				stdMs / std::max( radixMs, 1e-9 ),
+				match ? "" : " | MISMATCH" );
+		}
+	}
+}
+
+//--------------------------------------------------------------
+// gla::post_process_rgba
+//--------------------------------------------------------------
+
+// The pow based version the tables replaced; they have to agree
+// with it on every byte.
+static void Bench_PostProcessReference( uint8_t* imageData, size_t length, uint32_t flags )
+{
+	for ( size_t i = 0; i < length; i += 4 )
+	{
+		float r = glm::pow( ( ( float )imageData[ i + 0 ] ) * gla::inverse255, gla::gammaDecode );
+		float g = glm::pow( ( ( float )imageData[ i + 1 ] ) * gla::inverse255, gla::gammaDecode );
+		float b = glm::pow( ( ( float )imageData[ i + 2 ] ) * gla::inverse255, gla::gammaDecode );
+		float a = glm::pow( ( ( float )imageData[ i + 3 ] ) * gla::inverse255, gla::gammaDecode );
+
+		if ( flags & GL_ATLAS_POST_PROCESS_RGBA_BRIGHTEN )
+		{
+			uint8_t tmp[ 3 ] =
+			{
+				( uint8_t )( r * 255.0f ),
+				( uint8_t )( g * 255.0f ),
+				( uint8_t )( b * 255.0f )
+			};
+
+			gla::brighten_rgb( &tmp[ 0 ] );
+
+			r = ( ( float )tmp[ 0 ] ) * gla::inverse255;
+			g = ( ( float )tmp[ 1 ] ) * gla::inverse255;
+			b = ( ( float )tmp[ 2 ] ) * gla::inverse255;
+		}
+
+		if ( flags & GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA )
+		{
+			r *= a;
+			g *= a;
+			b *= a;
+		}
+
+		imageData[ i + 0 ] = ( uint8_t )( glm::pow( r, gla::gammaEncode ) * 255.0f );
+		imageData[ i + 1 ] = ( uint8_t )( glm::pow( g, gla::gammaEncode ) * 255.0f );
+		imageData[ i + 2 ] = ( uint8_t )( glm::pow( b, gla::gammaEncode ) * 255.0f );
+	}
+}
+
+void Bench_PostProcessRGBA( void )
+{
+	// Without brighten every channel only depends on itself and alpha,
+	// so this covers every input the premultiply path can see
+	{
+		std::vector< uint8_t > source( 256 * 256 * 4 );
+
+		for ( uint32_t a = 0; a < 256; ++a )
+		{
+			for ( uint32_t c = 0; c < 256; ++c )
+			{
+				uint8_t* p = &source[ ( a * 256 + c ) * 4 ];
+				p[ 0 ] = ( uint8_t ) c;
+				p[ 1 ] = ( uint8_t ) ( 255 - c );
+				p[ 2 ] = ( uint8_t ) ( c ^ 0x5A );
+				p[ 3 ] = ( uint8_t ) a;
+			}
+		}
+
+		std::vector< uint8_t > expected( source ), actual( source );
+
+		Bench_PostProcessReference( &expected[ 0 ], expected.size(), GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA );
+		gla::post_process_rgba( &actual[ 0 ], actual.size(), GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA );
+
+		printf( "post_process_rgba | every ( channel, alpha ) pair | %s\n",
+			expected == actual ? "identical" : "MISMATCH" );
+	}
+
+	const size_t dims = 1024;
+	const size_t length = dims * dims * 4;
+	const double mpix = ( double )( dims * dims ) / 1e6;
+
+	std::mt19937 rng( 1337 );
+
+	std::vector< uint8_t > source( length );
+
+	for ( uint8_t& b: source )
+	{
+		b = ( uint8_t ) rng();
+	}
+
+	std::vector< uint8_t > work, expected;
+
+	auto LPrepare = [ & ]( void ) { work.assign( source.begin(), source.end() ); };
+
+	const uint32_t flagSets[] =
+	{
+		GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA,
+		GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA | GL_ATLAS_POST_PROCESS_RGBA_BRIGHTEN
+	};
+
+	// Builds the tables outside of the timings
+	gla::gamma_tables();
+
+	for ( uint32_t flags: flagSets )
+	{
+		double powMs = Bench_Time( 5, LPrepare, [ & ]( void )
+		{
+			Bench_PostProcessReference( &work[ 0 ], work.size(), flags );
+		} );
+
+		expected.assign( work.begin(), work.end() );
+
+		double tableMs = Bench_Time( 20, LPrepare, [ & ]( void )
+		{
+			gla::post_process_rgba( &work[ 0 ], work.size(), flags );
+		} );
+
+		printf( "post_process_rgba | " F_SIZE_T "x" F_SIZE_T ", %s | pow: %.1f MPix/s | tables: %.1f MPix/s | %.2fx%s\n",
+			dims,
+			dims,
+			( flags & GL_ATLAS_POST_PROCESS_RGBA_BRIGHTEN ) ? "premul + brighten" : "premul",
+			mpix / ( powMs * 1e-3 ),
+			mpix / ( std::max( tableMs, 1e-9 ) * 1e-3 ),
+			powMs / std::max( tableMs, 1e-9 ),
+			work == expected ? "" : " | MISMATCH" );
+	}
+}
+
+//--------------------------------------------------------------
+// GU_IngestLightmap
+//--------------------------------------------------------------
+
+void Bench_LightmapIngest( void )
+{
+	const size_t count = 256;
+	const size_t pixels = BSP_LIGHTMAP_WIDTH * BSP_LIGHTMAP_HEIGHT;
+	const double mpix = ( double )( count * pixels ) / 1e6;
+
+	std::mt19937 rng( 1337 );
+
+	// Half of them are kept dark, so both sides of brighten_rgb's
+	// 255 threshold get plenty of coverage
+	std::vector< bspLightmap_t > lightmaps( count );
+
+	for ( size_t i = 0; i < count; ++i )
+	{
+		uint8_t* bytes = &lightmaps[ i ].map[ 0 ][ 0 ][ 0 ];
+		uint32_t mask = ( i & 1 ) ? 0x3F : 0xFF;
+
+		for ( size_t j = 0; j < pixels * 3; ++j )
+		{
+			bytes[ j ] = ( uint8_t )( rng() & mask );
+		}
+	}
+
+	// Builds the tables outside of the timings
+	static const guLightmapIngest_t tables;
+
+	gla::atlas_t expected;
+	std::vector< bspLightmap_t > scratch;
+
+	double pushMs = Bench_Time( 5,
+		[ & ]( void )
+		{
+			expected.free_memory();
+			scratch.assign( lightmaps.begin(), lightmaps.end() );
+		},
+		[ & ]( void )
+		{
+			for ( bspLightmap_t& lightmap: scratch )
+			{
+				uint8_t* bytes = &lightmap.map[ 0 ][ 0 ][ 0 ];
+
+				for ( size_t j = 0; j < pixels * 3; j += 3 )
+				{
+					gla::brighten_rgb( &bytes[ j ] );
+				}
+
+				gla::push_atlas_image( expected, bytes, BSP_LIGHTMAP_WIDTH, BSP_LIGHTMAP_HEIGHT,
+					3, GL_ATLAS_POST_PROCESS_RGBA_PREMUL_ALPHA, false );
+			}
+		} );
+
+	std::vector< uint8_t > actual( count * pixels * 4 );
+
+	double ingestMs = Bench_Time( 20, []( void ) {}, [ & ]( void )
+	{
+		for ( size_t i = 0; i < count; ++i )
+		{
+			GU_IngestLightmap( tables, lightmaps[ i ], &actual[ i * pixels * 4 ] );
+		}
+	} );
+
+	bool match = expected.buffer_table.size() == count;
+
+	for ( size_t i = 0; i < count && match; ++i )
+	{
+		match = memcmp( &expected.buffer_table[ i ][ 0 ], &actual[ i * pixels * 4 ], pixels * 4 ) == 0;
+	}
+
+	printf( "lightmap ingest | " F_SIZE_T " lightmaps | brighten + push: %.1f MPix/s | ingest: %.1f MPix/s | %.2fx%s\n",
+		count,
+		mpix / ( pushMs * 1e-3 ),
+		mpix / ( std::max( ingestMs, 1e-9 ) * 1e-3 ),
+		pushMs / std::max( ingestMs, 1e-9 ),
+		match ? "" : " | MISMATCH" );
+}
+
+//--------------------------------------------------------------
+// gla::flip_rows_rgba
+//--------------------------------------------------------------
+
+// The pixel at a time swap the row copies replaced
+static void Bench_FlipRowsReference( uint8_t* imageData, size_t dimX, size_t dimY )
+{
+	for ( size_t y = 0; y < ( dimY >> 1 ); ++y )
+	{
+		for ( size_t x = 0; x < dimX; ++x )
+		{
+			size_t top = ( y * dimX + x ) * 4;
+			size_t bottom = ( ( dimY - y - 1 ) * dimX + x ) * 4;
+
+			uint32_t pixel = gla::pack_rgba( &imageData[ top ] );
+			gla::unpack_rgba( &imageData[ top ], gla::pack_rgba( &imageData[ bottom ] ) );
+			gla::unpack_rgba( &imageData[ bottom ], pixel );
+		}
+	}
+}
+
+void Bench_FlipRows( void )
+{
+	const size_t dims[] = { 256, 512, 1024 };
+
+	std::mt19937 rng( 1337 );
+
+	std::vector< uint8_t > row;
+
+	for ( size_t d: dims )
+	{
+		std::vector< uint8_t > source( d * d * 4 );
+
+		for ( uint8_t& b: source )
+		{
+			b = ( uint8_t ) rng();
+		}
+
+		std::vector< uint8_t > work( source ), expected( source );
+
+		Bench_FlipRowsReference( &expected[ 0 ], d, d );
+		gla::flip_rows_rgba( &work[ 0 ], d, d, row );
+
+		bool match = work == expected;
+
+		uint32_t iterations = ( uint32_t ) std::max( ( size_t ) 10, ( 1024 * 1024 * 50 ) / ( d * d ) );
+
+		double pixelMs = Bench_Time( iterations, []( void ) {}, [ & ]( void )
+		{
+			Bench_FlipRowsReference( &work[ 0 ], d, d );
+		} );
+
+		double rowMs = Bench_Time( iterations, []( void ) {}, [ & ]( void )
+		{
+			gla::flip_rows_rgba( &work[ 0 ], d, d, row );
+		} );
+
+		printf( "flip_rows_rgba | " F_SIZE_T "x" F_SIZE_T " | pixels: %.4f ms | rows: %.4f ms | %.2fx%s\n",
+			d,
+			d,
+			pixelMs,
+			rowMs,
+			pixelMs / std::max( rowMs, 1e-9 ),
+			match ? "" : " | MISMATCH" );
+
+		// What push_atlas_image spends staging an RGBA image, with the
+		// flip and with it skipped in favour of top down texture coordinates
+		std::vector< uint8_t > staging( source.size() );
+
+		double flipMs = Bench_Time( iterations, []( void ) {}, [ & ]( void )
+		{
+			memcpy( &staging[ 0 ], &source[ 0 ], source.size() );
+			gla::flip_rows_rgba( &staging[ 0 ], d, d, row );
+		} );
+
+		double skipMs = Bench_Time( iterations, []( void ) {}, [ & ]( void )
+		{
+			memcpy( &staging[ 0 ], &source[ 0 ], source.size() );
+		} );
+
+		printf( "flip_rows_rgba | " F_SIZE_T "x" F_SIZE_T " | staging, flipped: %.4f ms | staging, flip skipped: %.4f ms\n",
+			d,
+			d,
+			flipMs,
+			skipMs );
+	}
+}
+
+//--------------------------------------------------------------
+// gla::skyline_packer_t
+//--------------------------------------------------------------
+
+// Every image inside its layer and none of them overlapping
+static bool Bench_ValidLayout( const gla::atlas_t& atlas, const gla::atlas_layout_t& layout )
+{
+	for ( size_t L = 0; L < layout.widths.size(); ++L )
+	{
+		std::vector< uint8_t > covered( ( size_t ) layout.widths[ L ] * layout.heights[ L ], 0 );
+
+		for ( uint32_t i = 0; i < atlas.num_images; ++i )
+		{
+			if ( layout.layers[ i ] != L )
+			{
+				continue;
+			}
+
+			if ( layout.coords_x[ i ] + atlas.dims_x[ i ] > layout.widths[ L ]
+				|| layout.coords_y[ i ] + atlas.dims_y[ i ] > layout.heights[ L ] )
+			{
+				return false;
+			}
+
+			for ( uint32_t y = 0; y < atlas.dims_y[ i ]; ++y )
+			{
+				uint8_t* row = &covered[ ( size_t )( layout.coords_y[ i ] + y ) * layout.widths[ L ]
+					+ layout.coords_x[ i ] ];
+
+				for ( uint32_t x = 0; x < atlas.dims_x[ i ]; ++x )
+				{
+					if ( row[ x ]++ )
+					{
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+void Bench_AtlasPack( void )
+{
+	struct imageSet_t
+	{
+		const char* name;
+		uint32_t count;
+		bool lightmaps;
+	};
+
+	// Shader and map textures are mostly power of two squares and
+	// strips; lightmaps are all 128 x 128
+	const imageSet_t sets[] =
+	{
+		{ "textures", 200, false },
+		{ "textures", 800, false },
+		{ "lightmaps", 100, true },
+		{ "lightmaps", 400, true }
+	};
+
+	const uint16_t maxDims = 8192;
+
+	std::mt19937 rng( 1337 );
+
+	for ( const imageSet_t& set: sets )
+	{
+		// Only the dimensions matter to the packer, so
+		// there's no image data behind these
+		gla::atlas_t atlas;
+
+		for ( uint32_t i = 0; i < set.count; ++i )
+		{
+			uint16_t w = 128, h = 128;
+
+			if ( !set.lightmaps )
+			{
+				w = ( uint16_t )( 16 << ( rng() % 6 ) );
+				h = ( rng() & 3 ) ? w : ( uint16_t )( 16 << ( rng() % 6 ) );
+			}
+
+			atlas.dims_x.push_back( w );
+			atlas.dims_y.push_back( h );
+			atlas.area_accum += w * h;
+			atlas.num_images++;
+		}
+
+		gla::skyline_packer_t packer;
+		gla::atlas_layout_t layout;
+
+		bool packed = false;
+
+		double ms = Bench_Time( 10, []( void ) {}, [ & ]( void )
+		{
+			packed = packer.pack( atlas, maxDims, layout );
+		} );
+
+		printf( "atlas pack | %s, %u images | %s: %u layers, %.1f%% used | %.3f ms%s\n",
+			set.name,
+			set.count,
+			packer.name(),
+			( uint32_t ) layout.widths.size(),
+			gla::atlas_layout_efficiency( atlas, layout ) * 100.0f,
+			ms,
+			packed && Bench_ValidLayout( atlas, layout ) ? "" : " | INVALID" );
+	}
+}
+
+void Bench_RunAll( void )
+{
+	Bench_DrawFaceSort();
+	Bench_PostProcessRGBA();
+	Bench_LightmapIngest();
+	Bench_FlipRows();
+	Bench_AtlasPack();
+}
+
+int main( void )
+{
+	Bench_RunAll();
+
+	return 0;
+}
+
+#endif // BSPVIEW_BENCHMARKS
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "../common.h"
+
+// Microbenchmarks for hot paths which don't need a GL context or a map.
+// They're kept out of the viewer; `make bench` builds bench.cpp on its
+// own (with BSPVIEW_BENCHMARKS defined) into bench.js, whose main()
+// runs them, prints the results and exits.
+
+void Bench_DrawFaceSort( void );
+
+// Checks the tabulated gamma curve against the pow based original
+// byte for byte, and reports both in MPix/s
+void Bench_PostProcessRGBA( void );
+
+// GU_IngestLightmap against the brighten_rgb + push_atlas_image chain
+// it replaced, over random lightmaps; the output has to be identical
+void Bench_LightmapIngest( void );
+
+// Row copy flip against the old pixel swap at 256, 512 and 1024
+// squared, and what skipping the flip saves when staging an image
+void Bench_FlipRows( void );
+
+// Packing time and efficiency of the skyline packer over made up
+// texture and lightmap sets, with each layout checked for overlaps
+void Bench_AtlasPack( void );
+
+void Bench_RunAll( void );
@@ -3,6 +3,7 @@
 #include "../glutil.h"
 #include "renderer/buffer.h"
 #include "renderer/context_window.h"
+#include "map_cache.h"
 
 #if defined( EMSCRIPTEN )
 #	include <emscripten.h>
@@ -78,6 +79,12 @@ Test::Test( int w, int h, bool fullscreen_,
 #if defined( EMSCRIPTEN )
 	EM_MountFS();
 #endif
+
+	// Started here rather than with the renderer, so the cache's storage
+	// has loaded well before the first map gets to it
+#if defined( MAP_CACHE_ENABLED )
+	MapCache_Init();
+#endif
 }
 
 Test::~Test( void )
@@ -6,6 +6,8 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <unordered_map>
+#include <ctype.h>
 #include <assert.h>
 #include <stdarg.h>
 #include "wapi.h"
@@ -79,14 +81,17 @@ static INLINE std::string StripExt( const std::string& name )
 	return name.substr( 0, index );
 }
 
-static std::string ReplaceExt( const std::string& path,
-	const std::string& ext )
+// Bundle paths and the paths shaders ask for don't always agree on case
+static INLINE std::string ToLower( const char* str, size_t len )
 {
-	std::string f( StripExt( path ) );
+	std::string out( str, len );
 
-	f.append( ext );
+	for ( char& c: out )
+	{
+		c = ( char ) tolower( ( unsigned char ) c );
+	}
 
-	return f;
+	return out;
 }
 
 static INLINE void FailOpen( const char* path, size_t pathLen )
@@ -116,8 +121,6 @@ static INLINE bool SplitDataWithBundle( std::string& bundleName,
 	return false;
 }
 
-static void ReadImage_Proxy( const char* path, int size );
-
 typedef void ( *callback_t )( char* data, int size );
 
 static bool gInitialized = false;
@@ -260,6 +263,29 @@ struct file_t
 		return Read( 0, ftell( ptr ) );
 	}
 
+	// Same as Read( offset, size ), except the data is prefixed
+	// with a wApiLumpHeader_t so the client knows where it belongs.
+	bool ReadLump( uint32_t index, size_t offset, size_t size )
+	{
+		if ( !ptr )
+		{
+			return false;
+		}
+
+		wApiLumpHeader_t header;
+		header.index = index;
+
+		readBuff.clear();
+		readBuff.resize( sizeof( header ) + size + 1, 0 );
+
+		memcpy( &readBuff[ 0 ], &header, sizeof( header ) );
+
+		fseek( ptr, offset, SEEK_SET );
+		fread( &readBuff[ sizeof( header ) ], size, 1, ptr );
+
+		return true;
+	}
+
 	void Send( void )
 	{
 		if ( readBuff.empty() )
@@ -269,12 +295,7 @@ struct file_t
 		}
 		else
 		{
-			uint8_t checksum = WAPI_CalcCheckSum(
-				( char* ) &readBuff[ 0 ],
-		 		readBuff.size() - 1
-			);
-
-			readBuff[ readBuff.size() - 1 ] = ( char ) checksum;
+			WriteCheckSum();
 
 			emscripten_worker_respond(
 				( char* ) &readBuff[ 0 ],
@@ -283,6 +304,31 @@ struct file_t
 		}
 	}
 
+	void SendProvisionally( void )
+	{
+		if ( readBuff.empty() )
+		{
+			return;
+		}
+
+		WriteCheckSum();
+
+		emscripten_worker_respond_provisionally(
+			( char* ) &readBuff[ 0 ],
+			readBuff.size()
+		);
+	}
+
+	void WriteCheckSum( void )
+	{
+		uint8_t checksum = WAPI_CalcCheckSum(
+			( char* ) &readBuff[ 0 ],
+			readBuff.size() - 1
+		);
+
+		readBuff[ readBuff.size() - 1 ] = ( char ) checksum;
+	}
+
 	~file_t( void )
 	{
 		if ( ptr )
@@ -325,6 +371,69 @@ class Bundle
 	const bufferMeta_t* bufferInfo = nullptr; // is not a buffer of memory: just one struct "instance"
 	const bundleMeta_t* metadata = nullptr; // *is* a buffer of memory, there's going to be X count of entries.
 
+	// Lowercase, extension-stripped path -> first metadata entry with that
+	// name. Every other format of the same name follows from there
+	// through nextFormat, in bundle order, ending at -1.
+	std::unordered_map< std::string, int32_t > index;
+	std::vector< int32_t > nextFormat;
+
+	static size_t PathLength( const bundleMeta_t& m )
+	{
+		return strnlen( m.filepath, BUNDLE_PATH_SIZE );
+	}
+
+	static bool HasExt( const bundleMeta_t& m, const std::string& ext )
+	{
+		size_t len = PathLength( m );
+
+		if ( len < ext.size() )
+		{
+			return false;
+		}
+
+		return ToLower( m.filepath + len - ext.size(), ext.size() ) == ext;
+	}
+
+	void BuildIndex( void )
+	{
+		index.clear();
+		index.reserve( numMetaEntries );
+
+		nextFormat.assign( numMetaEntries, -1 );
+
+		// Walk backward so each chain comes out in bundle order
+		for ( int32_t i = ( int32_t ) numMetaEntries - 1; i >= 0; --i )
+		{
+			std::string key( StripExt( ToLower( metadata[ i ].filepath,
+				PathLength( metadata[ i ] ) ) ) );
+
+			auto it = index.find( key );
+
+			if ( it != index.end() )
+			{
+				nextFormat[ i ] = it->second;
+				it->second = i;
+			}
+			else
+			{
+				index.emplace( std::move( key ), i );
+			}
+		}
+	}
+
+	// First entry in the chain for path's name, or -1. ext receives
+	// path's lowercase extension, dot included, if it has one.
+	int32_t FindChain( const char* path, std::string& ext ) const
+	{
+		std::string lower( ToLower( path, strlen( path ) ) );
+
+		GetExt( lower, ext );
+
+		auto it = index.find( StripExt( lower ) );
+
+		return it != index.end() ? it->second : -1;
+	}
+
 public:
 	size_t GetIterator( void ) const { return iterator; }
 
@@ -338,6 +447,9 @@ public:
 		metadata = nullptr;
 		numMetaEntries = 0;
 
+		index.clear();
+		nextFormat.clear();
+
 		// If the AL.buffer.ptr is already freed then this will nop since
 		// the free function makes sure that AL.buffer.ptr != 0
 		// before proceeding. AL.buffer.ptr is set to 0
@@ -380,6 +492,8 @@ public:
 		bundle = &buffer[ sizeof( *bufferInfo ) + bufferInfo->metaByteLen ];
 
 		numMetaEntries = bufferInfo->metaByteLen / sizeof( *metadata );
+
+		BuildIndex();
 	}
 
 	void SendImageStreamHeader( void ) const
@@ -405,13 +519,22 @@ public:
 		return &bundle[ m.startOffset ];
 	}
 
+	// A path without an extension matches whichever format of it
+	// comes first in the bundle.
 	int FindFile( const char* path ) const
 	{
-		size_t len = strlen( path );
+		std::string ext;
 
-		for ( uint32_t i = 0; i < numMetaEntries; ++i )
+		int32_t i = FindChain( path, ext );
+
+		if ( ext.empty() )
+		{
+			return i;
+		}
+
+		for ( ; i >= 0; i = nextFormat[ i ] )
 		{
-			if ( strncmp( path, metadata[ i ].filepath, len ) == 0 )
+			if ( HasExt( metadata[ i ], ext ) )
 			{
 				return i;
 			}
@@ -420,6 +543,49 @@ public:
 		return -1;
 	}
 
+	// Shader image paths often name a format which isn't on disk, so
+	// this falls back to the first of .jpg, .tga and .jpeg that is.
+	// It's all one chain, so the fallbacks cost nothing extra to find.
+	int FindImage( const char* path ) const
+	{
+		static const std::array< std::string, 3 > candidates =
+		{{
+			".jpg", ".tga", ".jpeg"
+		}};
+
+		std::string ext;
+
+		int32_t first = FindChain( path, ext );
+
+		if ( ext.empty() )
+		{
+			return first;
+		}
+
+		int32_t best = -1;
+		size_t bestRank = candidates.size();
+
+		for ( int32_t i = first; i >= 0; i = nextFormat[ i ] )
+		{
+			if ( HasExt( metadata[ i ], ext ) )
+			{
+				return i;
+			}
+
+			for ( size_t c = 0; c < bestRank; ++c )
+			{
+				if ( HasExt( metadata[ i ], candidates[ c ] ) )
+				{
+					best = i;
+					bestRank = c;
+					break;
+				}
+			}
+		}
+
+		return best;
+	}
+
 	const char* GetFile( const char* path, int& outSize ) const
 	{
 		int index = FindFile( path );
@@ -441,24 +607,34 @@ public:
 		return ext == ".shader";
 	}
 
-	std::vector< char > ReadImage( const char* filename )
+	std::vector< char > ReadImage( const char* filename ) const
+	{
+		int fileIndex = FindImage( filename );
+
+		if ( fileIndex < 0 )
+		{
+			O_Log( "ERROR: Could not find image file: %s", filename );
+			return std::vector< char >();
+		}
+
+		return ReadImage( fileIndex, filename );
+	}
+
+	// Images are always sent as RGBA: stb does the expansion while
+	// decoding, so it happens here in the worker rather than on the
+	// main thread.
+	std::vector< char > ReadImage( int fileIndex, const char* filename ) const
 	{
 		std::vector< char > imgBuff;
 
 		int width, height, bpp; // bpp is in bytes...
 
 		int outSize;
-		const char* ptr = GetFile( filename, outSize );
-
-		if ( !ptr )
-		{
-			O_Log( "ERROR: Could not find image file: %s", filename );
-			return imgBuff;
-		}
+		const char* ptr = GetFile( fileIndex, outSize );
 
 		stbi_uc* buf = stbi_load_from_memory(
 			( const stbi_uc* ) ptr, outSize, &width, &height, &bpp,
-			STBI_default );
+			STBI_rgb_alpha );
 
 		if ( !buf )
 		{
@@ -466,6 +642,8 @@ public:
 			return imgBuff;
 		}
 
+		bpp = STBI_rgb_alpha;
+
 		size_t size = width * height * bpp;
 
 		// Prefix with the filepath: this will always be 64 bytes.
@@ -577,17 +755,29 @@ public:
 		FinishStream();
 	}
 
-	void SendNextImage( void )
+	static void SendImage( const std::vector< char >& imgBuff )
 	{
-		if ( iterator < GetNumFiles() )
+		// Nothing is sent for an image which failed to decode
+		if ( !imgBuff.empty() )
 		{
-			ReadImage_Proxy(
-				metadata[ iterator ].filepath,
-				strlen( metadata[ iterator ].filepath )
-			);
+			emscripten_worker_respond_provisionally(
+				( char* ) &imgBuff[ 0 ], imgBuff.size() );
+		}
+	}
 
-			iterator++;
+	// Decodes every remaining image and sends each one as soon as it's
+	// ready
+	void StreamImages( void )
+	{
+		uint32_t first = ( uint32_t ) iterator;
+		uint32_t count = ( uint32_t ) ( GetNumFiles() - iterator );
+
+		for ( uint32_t i = 0; i < count; ++i )
+		{
+			SendImage( ReadImage( first + i, metadata[ first + i ].filepath ) );
 		}
+
+		iterator = GetNumFiles();
 	}
 
 	~Bundle( void )
@@ -723,54 +913,11 @@ static void ReadShaders_Proxy( char* data, int size )
 	);
 }
 
-static void ReadImage_Proxy( const char* path, int size )
-{
-	std::string pathString( path );
-
-	std::vector< char > imgBuff = gBundle->ReadImage( pathString.c_str() );
-
-	if ( imgBuff.empty() )
-	{
-		std::array< std::string, 3 > candidates =
-		{
-			".jpg", ".tga", ".jpeg"
-		};
-
-		std::string firstExt;
-		volatile bool hasExt = GetExt( pathString, firstExt );
-
-		for ( size_t i = 0; i < candidates.size() && imgBuff.empty(); ++i )
-		{
-			if ( hasExt && firstExt == candidates[ i ] )
-			{
-				continue;
-			}
-
-			pathString = ReplaceExt( pathString, candidates[ i ] );
-
-			imgBuff = gBundle->ReadImage( pathString.c_str() );
-		}
-
-		if ( imgBuff.empty() )
-		{
-			std::vector< char > blankBuffer( 64 + 8 );
-			return;
-		}
-	}
-
-	emscripten_worker_respond_provisionally( &imgBuff[ 0 ], imgBuff.size() );
-}
-
 static void LoadImagesAndStream( char* buffer, int size )
 {
 	gBundle->Load( buffer, size );
 	gBundle->SendImageStreamHeader();
-
-	while ( gBundle->GetIterator() < gBundle->GetNumFiles() )
-	{
-		gBundle->SendNextImage();
-	}
-
+	gBundle->StreamImages();
 	gBundle->FinishStream();
 }
 
@@ -856,6 +1003,42 @@ void ReadMapFile_Chunk( char* bcmd, int size )
 	gFIOChain->Send();
 }
 
+// Batched counterpart to ReadMapFile_Chunk: the whole lump directory
+// arrives in one request, and every lump is streamed back provisionally
+// as soon as it's read. See wApiLumpHeader_t.
+void ReadMapFile_Lumps( char* bcmd, int size )
+{
+	if ( !gFIOChain || !( *gFIOChain ) )
+	{
+		O_Log( "%s",  "No file initialized..." );
+		emscripten_worker_respond( nullptr, 0 );
+		return;
+	}
+
+	const wApiChunkInfo_t* cmds = ( const wApiChunkInfo_t* )bcmd;
+	uint32_t numCmds = ( uint32_t )( size / sizeof( *cmds ) );
+
+	for ( uint32_t i = 0; i < numCmds; ++i )
+	{
+		if ( !cmds[ i ].size )
+		{
+			continue;
+		}
+
+		O_Log(
+			"Lump %u - offset: " F_SIZE_T ", size: " F_SIZE_T "\n",
+			i,
+			cmds[ i ].offset,
+			cmds[ i ].size
+		);
+
+		gFIOChain->ReadLump( i, cmds[ i ].offset, cmds[ i ].size );
+		gFIOChain->SendProvisionally();
+	}
+
+	emscripten_worker_respond( nullptr, 0 );
+}
+
 void ReadShaders( char* dir, int size )
 {
 	O_Log( "%s",  "Worker: ReadShaders entering" );
@@ -1,7 +1,10 @@
 #pragma once
 
 #include "commondef.h"
-#include <emscripten.h>
+
+#if defined( EMSCRIPTEN )
+#	include <emscripten.h>
+#endif
 #include <stdlib.h>
 
 extern "C" {
@@ -14,6 +17,18 @@ struct wApiChunkInfo_t
 	size_t size;
 };
 
+// ReadMapFile_Lumps takes an array of wApiChunkInfo_t (one per lump,
+// in directory order) and streams each non-empty lump back as its own
+// provisional response, laid out as:
+//
+// [ wApiLumpHeader_t ][ lump bytes ][ checksum byte ]
+//
+// The stream is terminated by a final, empty response.
+struct wApiLumpHeader_t
+{
+	uint32_t index; // into the wApiChunkInfo_t array which was sent
+};
+
 static const uint32_t WAPI_ERROR = 0xFFFFFFFF;
 static const uint32_t WAPI_TRUE = 1;
 static const uint32_t WAPI_FALSE = 0;